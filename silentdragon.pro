@@ -12,6 +12,7 @@ PRECOMPILED_HEADER = src/precompiled.h
 
 QT += widgets
 QT += websockets
+QT += concurrent
 
 TARGET = silentdragon
 
@@ -50,6 +51,12 @@ SOURCES += \
     src/settings.cpp \
     src/sendtab.cpp \
     src/senttxstore.cpp \
+    src/txcache.cpp \
+    src/recordlog.cpp \
+    src/walletstate.cpp \
+    src/rpcmetrics.cpp \
+    src/rpcreader.cpp \
+    src/parammanager.cpp \
     src/txtablemodel.cpp \
     src/qrcodelabel.cpp \
     src/connection.cpp \
@@ -76,6 +83,12 @@ HEADERS += \
     src/settings.h \
     src/txtablemodel.h \
     src/senttxstore.h \
+    src/txcache.h \
+    src/recordlog.h \
+    src/walletstate.h \
+    src/rpcmetrics.h \
+    src/rpcreader.h \
+    src/parammanager.h \
     src/qrcodelabel.h \
     src/connection.h \
     src/fillediconlabel.h \
@@ -4,6 +4,7 @@
 #include "settings.h"
 #include "mainwindow.h"
 #include "rpc.h"
+#include "recordlog.h"
 
 
 AddressBookModel::AddressBookModel(QTableView *parent)
@@ -41,6 +42,17 @@ void AddressBookModel::addNewLabel(QString label, QString addr) {
     layoutChanged();
 }
 
+// Add all the labels with a single write, and a single reset of the view
+void AddressBookModel::addNewLabels(const QList<QPair<QString, QString>>& newLabels) {
+    if (newLabels.isEmpty())
+        return;
+
+    beginResetModel();
+    AddressBook::getInstance()->addAddressLabels(newLabels);
+    labels = AddressBook::getInstance()->getAllAddressLabels();
+    endResetModel();
+}
+
 void AddressBookModel::removeItemAt(int row) {
     if (row >= labels.size())
         return;
@@ -150,38 +162,36 @@ void AddressBook::open(MainWindow* parent, QLineEdit* target) {
         model.addNewLabel(newLabel, ab.addr->text());
     });
 
-    // Import Button
-    QObject::connect(ab.btnImport, &QPushButton::clicked, [&] () {
-        // Get the import file name.
-        auto fileName = QFileDialog::getOpenFileUrl(&d, QObject::tr("Import Address Book"), QUrl(), 
-            "CSV file (*.csv)");
-        if (fileName.isEmpty())
-            return;
+    // Import Button. The file is parsed and validated on a worker thread, and the result is added
+    // to the address book in one batch when it's done. The watcher belongs to the dialog, so
+    // nothing happens if the dialog is closed before the import finishes.
+    auto importWatcher = new QFutureWatcher<AddressBookImport>(&d);
+    QObject::connect(importWatcher, &QFutureWatcher<AddressBookImport>::finished, [&, importWatcher] () {
+        auto result = importWatcher->result();
+        ab.btnImport->setEnabled(true);
 
-        QFile file(fileName.toLocalFile());
-        if (!file.open(QIODevice::ReadOnly)) {
-            QMessageBox::information(&d, QObject::tr("Unable to open file"), file.errorString());
+        if (!result.error.isEmpty()) {
+            QMessageBox::information(&d, QObject::tr("Unable to open file"), result.error);
             return;
-        }        
+        }
 
-        QTextStream in(&file);
-        QString line;
-        int numImported = 0;
-        while (in.readLineInto(&line)) {
-            QStringList items = line.split(",");
-            if (items.size() != 2)
-                continue;
+        // Import them all in one go
+        model.addNewLabels(result.labels);
 
-            if (!Settings::isValidAddress(items.at(0)))
-                continue;
+        QMessageBox::information(&d, QObject::tr("Address Book Import Done"),
+            QObject::tr("Imported %1 new Address book entries").arg(result.labels.size()));
+    });
 
-            // Add label, address.
-            model.addNewLabel(items.at(1), items.at(0));
-            numImported++;
-        }
+    QObject::connect(ab.btnImport, &QPushButton::clicked, [&, importWatcher] () {
+        // Get the import file name.
+        auto fileName = QFileDialog::getOpenFileUrl(&d, QObject::tr("Import Address Book"), QUrl(), 
+            "CSV file (*.csv);;JSON file (*.json)");
+        if (fileName.isEmpty())
+            return;
 
-        QMessageBox::information(&d, QObject::tr("Address Book Import Done"),
-            QObject::tr("Imported %1 new Address book entries").arg(numImported));
+        ab.btnImport->setEnabled(false);
+        importWatcher->setFuture(QtConcurrent::run(&AddressBook::parseImportFile,
+            fileName.toLocalFile(), getInstance()->getAddressesByLabel()));
     });
 
     auto fnSetTargetLabelAddr = [=] (QLineEdit* target, QString label, QString addr) {
@@ -259,19 +269,50 @@ AddressBook::AddressBook() {
     readFromStorage();
 }
 
+// Record types in the address book journal
+enum AddressBookOp : quint8 {
+    LabelAdd    = 1,
+    LabelRemove = 2,
+    LabelRename = 3
+};
+
+QByteArray AddressBook::makeRecord(quint8 op, const QString& label, const QString& address,
+                                   const QString& newLabel) {
+    QByteArray record;
+    QDataStream out(&record, QIODevice::WriteOnly);
+    out << op << label << address;
+    if (op == LabelRename)
+        out << newLabel;
+
+    return record;
+}
+
+/**
+ * Load the labels from the journal, which is memory mapped and replayed. If there's no journal
+ * yet, the old addresslabels.dat is migrated into it once.
+ */
 void AddressBook::readFromStorage() {
-    QFile file(AddressBook::writeableFile());
+    auto journalFile = writeableFile(QStringLiteral("addresslabels.log"));
+    if (journal == nullptr || journal->fileName() != journalFile) {
+        delete journal;
+        journal = new RecordLog(journalFile);
+    }
 
-    if (file.exists()) {
-        allLabels.clear();
-        file.open(QIODevice::ReadOnly);
-        QDataStream in(&file);    // read the data serialized from the file
-        QString version;
-        in >> version >> allLabels; 
+    allLabels.clear();
 
-        file.close();
+    if (!journal->exists()) {
+        migrateDataFile();
+    } else {
+        for (const auto& record : journal->read()) {
+            applyRecord(record);
+        }
+
+        // Earlier versions kept the file they migrated from
+        QFile::remove(writeableFile(QStringLiteral("addresslabels.dat.migrated")));
     }
 
+    rebuildIndex();
+
     // Special. 
     // Add the default ZecWallet donation address if it isn't already present
     // QList<QString> allAddresses;
@@ -282,17 +323,93 @@ void AddressBook::readFromStorage() {
     // }
 }
 
-void AddressBook::writeToStorage() {
-    QFile file(AddressBook::writeableFile());
-    file.open(QIODevice::ReadWrite | QIODevice::Truncate);
-    QDataStream out(&file);   // we will serialize the data into the file
-    out << QString("v1") << allLabels;
+void AddressBook::migrateDataFile() {
+    QFile file(writeableFile(QStringLiteral("addresslabels.dat")));
+    if (!file.exists() || !file.open(QIODevice::ReadOnly))
+        return;
+
+    QDataStream in(&file);    // read the data serialized from the file
+    QString version;
+    in >> version >> allLabels;
     file.close();
+
+    QList<QByteArray> records;
+    for (const auto& i : allLabels) {
+        records.push_back(makeRecord(LabelAdd, i.first, i.second));
+    }
+
+    // QSaveFile syncs the journal to disk before it's renamed into place, so once the rewrite
+    // succeeded the old file isn't needed anymore. A copy of it would only leak the labels.
+    if (journal->rewrite(records)) {
+        qDebug() << "Migrated" << records.size() << "address labels to" << journal->fileName();
+        file.remove();
+    }
+}
+
+void AddressBook::applyRecord(const QByteArray& record) {
+    QDataStream in(record);
+    quint8 op;
+    QString label, address;
+    in >> op >> label >> address;
+
+    if (op == LabelAdd) {
+        // Replacing a label was logged as a remove before this add
+        allLabels.push_back(QPair<QString, QString>(label, address));
+    } else if (op == LabelRemove) {
+        for (int i = 0; i < allLabels.size(); i++) {
+            if (allLabels[i].first == label && allLabels[i].second == address) {
+                allLabels.removeAt(i);
+                break;
+            }
+        }
+    } else if (op == LabelRename) {
+        QString newLabel;
+        in >> newLabel;
+        for (int i = 0; i < allLabels.size(); i++) {
+            if (allLabels[i].first == label && allLabels[i].second == address) {
+                allLabels[i].first = newLabel;
+                break;
+            }
+        }
+    }
+}
+
+// Append the records to the journal, and compact it if it has grown too long
+void AddressBook::writeToStorage(const QList<QByteArray>& records) {
+    if (journal->fileName() != writeableFile(QStringLiteral("addresslabels.log"))) {
+        // The network changed since the labels were read, so start with a fresh journal
+        delete journal;
+        journal = new RecordLog(writeableFile(QStringLiteral("addresslabels.log")));
+        QList<QByteArray> all;
+        for (const auto& i : allLabels) {
+            all.push_back(makeRecord(LabelAdd, i.first, i.second));
+        }
+        journal->rewrite(all);
+        return;
+    }
+
+    if (journal->append(records))
+        compactIfNeeded();
 }
 
-QString AddressBook::writeableFile() {
-    auto filename = QStringLiteral("addresslabels.dat");
+/**
+ * Rewrite the journal with one record per label, once removes and renames have made it much
+ * longer than it needs to be. The rewrite goes to a temp file that is renamed over the journal.
+ */
+void AddressBook::compactIfNeeded() {
+    if (journal->count() < 2 * allLabels.size() + 64)
+        return;
+
+    QList<QByteArray> records;
+    for (const auto& i : allLabels) {
+        records.push_back(makeRecord(LabelAdd, i.first, i.second));
+    }
+
+    qDebug() << "Compacting" << journal->fileName() << "from" << journal->count() << "to" << records.size() << "records";
+    journal->rewrite(records);
+}
 
+QString AddressBook::writeableFile(const QString& filename) {
     auto dir = QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation));
     if (!dir.exists())
         QDir().mkpath(dir.absolutePath());
@@ -304,33 +421,100 @@ QString AddressBook::writeableFile() {
     }
 }
 
+// Index the labels both ways. The first entry wins, just like a scan of the list would find.
+// Adding a label updates the indexes in place. Removing or renaming one rebuilds them, and so does
+// a batch of adds, but only once for the whole batch.
+void AddressBook::rebuildIndex() {
+    addressForLabel.clear();
+    labelForAddress.clear();
+
+    for (const auto& i : allLabels) {
+        if (!addressForLabel.contains(i.first))
+            addressForLabel.insert(i.first, i.second);
+        if (!labelForAddress.contains(i.second))
+            labelForAddress.insert(i.second, i.first);
+    }
+}
 
-// Add a new address/label to the database
-void AddressBook::addAddressLabel(QString label, QString address) {
-    Q_ASSERT(Settings::isValidAddress(address));
-
+void AddressBook::addLabel(const QString& label, const QString& address, QList<QByteArray>& records) {
     // First, remove any existing label
-    // Iterate over the list and remove the label/address
-    for (int i=0; i < allLabels.size(); i++) {
-        if (allLabels[i].first == label) {
-            removeAddressLabel(allLabels[i].first, allLabels[i].second);
-        }
+    while (addressForLabel.contains(label)) {
+        removeLabel(label, addressForLabel.value(label), records);
     }
 
     allLabels.push_back(QPair<QString, QString>(label, address));
-    writeToStorage();
+    addressForLabel.insert(label, address);
+    if (!labelForAddress.contains(address))
+        labelForAddress.insert(address, label);
+
+    records.push_back(makeRecord(LabelAdd, label, address));
 }
 
-// Remove a new address/label from the database
-void AddressBook::removeAddressLabel(QString label, QString address) {
+bool AddressBook::removeLabel(const QString& label, const QString& address, QList<QByteArray>& records) {
     // Iterate over the list and remove the label/address
     for (int i=0; i < allLabels.size(); i++) {
         if (allLabels[i].first == label && allLabels[i].second == address) {
             allLabels.removeAt(i);
-            writeToStorage();
-            return;
+            rebuildIndex();
+
+            records.push_back(makeRecord(LabelRemove, label, address));
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Add a new address/label to the database
+void AddressBook::addAddressLabel(QString label, QString address) {
+    Q_ASSERT(Settings::isValidAddress(address));
+
+    QList<QByteArray> records;
+    addLabel(label, address, records);
+    writeToStorage(records);
+}
+
+/**
+ * Same as calling addAddressLabel for each of labels, in a single pass over the list. Every add
+ * replaces all the labels of the same name, including any added earlier in the batch, so only the
+ * last add of each label is kept.
+ */
+void AddressBook::addAddressLabels(const QList<QPair<QString, QString>>& labels) {
+    QHash<QString, int> lastAdd;
+    for (int i = 0; i < labels.size(); i++) {
+        Q_ASSERT(Settings::isValidAddress(labels[i].second));
+        lastAdd[labels[i].first] = i;
+    }
+
+    QList<QByteArray> records;
+    QList<QPair<QString, QString>> kept;
+    kept.reserve(allLabels.size() + lastAdd.size());
+    for (const auto& i : allLabels) {
+        if (lastAdd.contains(i.first)) {
+            records.push_back(makeRecord(LabelRemove, i.first, i.second));
+        } else {
+            kept.push_back(i);
         }
     }
+
+    for (int i = 0; i < labels.size(); i++) {
+        if (lastAdd.value(labels[i].first) != i)
+            continue;
+
+        kept.push_back(labels[i]);
+        records.push_back(makeRecord(LabelAdd, labels[i].first, labels[i].second));
+    }
+
+    allLabels = kept;
+    rebuildIndex();
+    writeToStorage(records);
+}
+
+// Remove a new address/label from the database
+void AddressBook::removeAddressLabel(QString label, QString address) {
+    QList<QByteArray> records;
+    if (removeLabel(label, address, records))
+        writeToStorage(records);
 }
 
 void AddressBook::updateLabel(QString oldlabel, QString address, QString newlabel) {
@@ -338,7 +522,8 @@ void AddressBook::updateLabel(QString oldlabel, QString address, QString newlabe
     for (int i = 0; i < allLabels.size(); i++) {
         if (allLabels[i].first == oldlabel && allLabels[i].second == address) {
             allLabels[i].first = newlabel;
-            writeToStorage();
+            rebuildIndex();
+            writeToStorage({ makeRecord(LabelRename, oldlabel, address, newlabel) });
             return;
         }
     }
@@ -354,22 +539,31 @@ const QList<QPair<QString, QString>>& AddressBook::getAllAddressLabels() {
 
 // Get the label for an address
 QString AddressBook::getLabelForAddress(QString addr) {
-    for (auto i : allLabels) {
-        if (i.second == addr)
-            return i.first;
-    }
-
-    return "";
+    return labelForAddress.value(addr);
 }
 
 // Get the address for a label
 QString AddressBook::getAddressForLabel(QString label) {
-    for (auto i: allLabels) {
-        if (i.first == label)
-            return i.second;
+    return addressForLabel.value(label);
+}
+
+QHash<QString, QString> AddressBook::getAddressesByLabel() {
+    getAllAddressLabels();
+    return addressForLabel;
+}
+
+QStringList AddressBook::getCompletions() {
+    QStringList list;
+    list.reserve(allLabels.size());
+    for (const auto& la : getAllAddressLabels()) {
+        list.push_back(la.first % "/" % la.second);
     }
 
-    return "";
+    std::sort(list.begin(), list.end(), [] (const QString& a, const QString& b) {
+        return QString::compare(a, b, Qt::CaseInsensitive) < 0;
+    });
+
+    return list;
 }
 
 QString AddressBook::addLabelToAddress(QString addr) {
@@ -380,6 +574,92 @@ QString AddressBook::addLabelToAddress(QString addr) {
         return addr;
 }
 
+AddressBookImport AddressBook::parseImportFile(const QString& fileName,
+                                               const QHash<QString, QString>& existing) {
+    AddressBookImport result;
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        result.error = file.errorString();
+        return result;
+    }
+
+    // Read the (address, label) rows as they are in the file
+    struct Row {
+        QString address;
+        QString label;
+        bool    valid;
+    };
+    QVector<Row> rows;
+    if (fileName.endsWith(".json", Qt::CaseInsensitive)) {
+        // Either [{"label": ..., "address": ...}, ...] or {"label": "address", ...}
+        QJsonParseError parseError;
+        auto doc = QJsonDocument::fromJson(file.readAll(), &parseError);
+        if (doc.isNull()) {
+            result.error = parseError.errorString();
+            return result;
+        }
+
+        if (doc.isArray()) {
+            for (const auto& it : doc.array()) {
+                auto obj = it.toObject();
+                rows.push_back(Row{ obj["address"].toString().trimmed(), obj["label"].toString().trimmed(), false });
+            }
+        } else {
+            auto obj = doc.object();
+            for (auto it = obj.constBegin(); it != obj.constEnd(); it++) {
+                rows.push_back(Row{ it.value().toString().trimmed(), it.key().trimmed(), false });
+            }
+        }
+    } else {
+        QTextStream in(&file);
+        QString line;
+        while (in.readLineInto(&line)) {
+            QStringList items = line.split(",");
+            if (items.size() != 2)
+                continue;
+
+            rows.push_back(Row{ items.at(0).trimmed(), items.at(1).trimmed(), false });
+        }
+    }
+    file.close();
+
+    // Validate all the addresses in parallel, that's where the time goes
+    QtConcurrent::blockingMap(rows, [] (Row& row) {
+        row.valid = !row.label.isEmpty() && Settings::isValidAddress(row.address);
+    });
+
+    // If a label is in the file more than once, the last one wins, just like adding them one by one
+    QHash<QString, int> newIndex;
+    for (int i = 0; i < rows.size(); i++) {
+        const auto& address = rows[i].address;
+        const auto& label   = rows[i].label;
+
+        if (!rows[i].valid) {
+            result.invalid++;
+            continue;
+        }
+
+        if (existing.value(label) == address) {
+            result.duplicate++;
+            continue;
+        }
+
+        auto entry = QPair<QString, QString>(label, address);
+        if (newIndex.contains(label)) {
+            result.duplicate++;
+            result.labels[newIndex[label]] = entry;
+        } else {
+            newIndex[label] = result.labels.size();
+            result.labels.push_back(entry);
+        }
+    }
+
+    qDebug() << "Parsed" << rows.size() << "address book rows from" << fileName << ":" << result.labels.size()
+             << "new," << result.invalid << "invalid," << result.duplicate << "duplicates";
+    return result;
+}
+
 QString AddressBook::addressFromAddressLabel(const QString& lblAddr) { 
     return lblAddr.trimmed().split("/").last(); 
 }
@@ -4,6 +4,15 @@
 #include "precompiled.h"
 
 class MainWindow;
+class RecordLog;
+
+// Result of parsing an address book file for import
+struct AddressBookImport {
+    QList<QPair<QString, QString>>  labels;         // label, address
+    int                             invalid   = 0;  // Rows that weren't a valid address
+    int                             duplicate = 0;  // Rows that are already in the address book
+    QString                         error;
+};
 
 class AddressBookModel : public QAbstractTableModel {
 
@@ -12,6 +21,7 @@ public:
     ~AddressBookModel();
                             
     void                    addNewLabel(QString label, QString addr);
+    void                    addNewLabels(const QList<QPair<QString, QString>>& newLabels);
     void                    removeItemAt(int row);
     QPair<QString, QString> itemAt(int row);
 
@@ -38,9 +48,17 @@ public:
     static QString addLabelToAddress(QString addr);
     static QString addressFromAddressLabel(const QString& lblAddr);
 
+    // Parse a CSV (address,label per line) or JSON file of labels. Meant to run on a worker thread,
+    // so it only looks at the given snapshot of getAddressesByLabel.
+    static AddressBookImport parseImportFile(const QString& fileName,
+                                             const QHash<QString, QString>& existing);
+
     // Add a new address/label to the database
     void addAddressLabel(QString label, QString address);
 
+    // Add many address/labels at once, with a single write to the database
+    void addAddressLabels(const QList<QPair<QString, QString>>& labels);
+
     // Remove a new address/label from the database
     void removeAddressLabel(QString label, QString address);
 
@@ -54,15 +72,37 @@ public:
     QString getLabelForAddress(QString address);
     // Get a Label's address
     QString getAddressForLabel(QString label);
+    // Every label's address, as getAddressForLabel finds it
+    QHash<QString, QString> getAddressesByLabel();
+
+    // All the "label/address" strings, sorted case insensitively for a QCompleter
+    QStringList getCompletions();
 private:
     AddressBook();
 
     void readFromStorage();
-    void writeToStorage();
+    void writeToStorage(const QList<QByteArray>& records);
+    void migrateDataFile();
+    void compactIfNeeded();
 
-    QString writeableFile();
+    void rebuildIndex();
+    void applyRecord(const QByteArray& record);
+    void addLabel(const QString& label, const QString& address, QList<QByteArray>& records);
+    bool removeLabel(const QString& label, const QString& address, QList<QByteArray>& records);
+
+    static QByteArray makeRecord(quint8 op, const QString& label, const QString& address,
+                                 const QString& newLabel = QString());
+
+    QString writeableFile(const QString& filename);
     QList<QPair<QString, QString>> allLabels;
 
+    // Change log of the labels. Every add, remove or rename is appended as one record.
+    RecordLog* journal = nullptr;
+
+    // Indexes into allLabels, kept in sync with it
+    QHash<QString, QString> addressForLabel;
+    QHash<QString, QString> labelForAddress;      // The address's first label
+
     static AddressBook* instance;
 };
 
@@ -7,48 +7,73 @@ BalancesTableModel::BalancesTableModel(QObject *parent)
     : QAbstractTableModel(parent) {    
 }
 
-void BalancesTableModel::setNewData(const QMap<QString, double>* balances, 
-    const QList<UnspentOutput>* outputs)
-{    
-    loading = false;
-
-    int currentRows = rowCount(QModelIndex());
-    // Copy over the utxos for our use
-    delete utxos;
-    utxos = new QList<UnspentOutput>();
-    // This is a QList deep copy.
-    *utxos = *outputs;
-
-    // Process the address balances into a list
-    delete modeldata;
-    modeldata = new QList<std::tuple<QString, double>>();
-    std::for_each(balances->keyBegin(), balances->keyEnd(), [=] (auto keyIt) {
-        if (balances->value(keyIt) > 0)
-            modeldata->push_back(std::make_tuple(keyIt, balances->value(keyIt)));
-    });
-
-    // And then update the data
-    dataChanged(index(0, 0), index(modeldata->size()-1, columnCount(index(0,0))-1));
-
-    // Change the layout only if the number of rows changed
-    if (modeldata && modeldata->size() != currentRows)
-        layoutChanged();
+/**
+ * Switch to a new wallet state. Both the old and the new rows are sorted by address, so one pass
+ * over them finds the rows that were removed, added or whose balance changed, and only those
+ * are signalled to the view.
+ */
+void BalancesTableModel::setNewData(WalletStatePtr newState)
+{
+    if (loading) {
+        beginResetModel();
+        loading = false;
+        endResetModel();
+    }
+
+    QVector<QString> newdata;
+    for (const auto& addr : newState->getAddresses()) {
+        if (newState->getBalanceZats(addr) > 0)
+            newdata.push_back(addr);
+    }
+
+    auto oldState = state;
+    state = newState;
+
+    int p = 0;      // Position in modeldata, which is updated as we go along
+    int i = 0;      // Position in newdata
+    while (p < modeldata.size() || i < newdata.size()) {
+        if (p < modeldata.size() && (i == newdata.size() || modeldata.at(p) < newdata.at(i))) {
+            int q = p;
+            while (q < modeldata.size() && (i == newdata.size() || modeldata.at(q) < newdata.at(i)))
+                q++;
+
+            beginRemoveRows(QModelIndex(), p, q - 1);
+            modeldata.remove(p, q - p);
+            endRemoveRows();
+        } else if (i < newdata.size() && (p == modeldata.size() || newdata.at(i) < modeldata.at(p))) {
+            int j = i;
+            while (j < newdata.size() && (p == modeldata.size() || newdata.at(j) < modeldata.at(p)))
+                j++;
+
+            beginInsertRows(QModelIndex(), p, p + (j - i) - 1);
+            for (int k = i; k < j; k++)
+                modeldata.insert(p + (k - i), newdata.at(k));
+            endInsertRows();
+
+            p += j - i;
+            i = j;
+        } else {
+            const auto& addr = modeldata.at(p);
+            if (!oldState || oldState->getBalanceZats(addr) != newState->getBalanceZats(addr) ||
+                    oldState->hasUnconfirmed(addr) != newState->hasUnconfirmed(addr)) {
+                emit dataChanged(index(p, 0), index(p, columnCount(QModelIndex()) - 1));
+            }
+
+            p++;
+            i++;
+        }
+    }
 }
 
 BalancesTableModel::~BalancesTableModel() {
-    delete modeldata;
-    delete utxos;
 }
 
 int BalancesTableModel::rowCount(const QModelIndex&) const
 {
-    if (modeldata == nullptr) {
-        if (loading) 
-            return 1;
-        else 
-            return 0;
-    }
-    return modeldata->size();
+    if (loading)
+        return 1;
+
+    return modeldata.size();
 }
 
 int BalancesTableModel::columnCount(const QModelIndex&) const
@@ -69,13 +94,10 @@ QVariant BalancesTableModel::data(const QModelIndex &index, int role) const
     
     if (role == Qt::ForegroundRole) {
         // If any of the UTXOs for this address has zero confirmations, paint it in red
-        const auto& addr = std::get<0>(modeldata->at(index.row()));
-        for (auto utxo : *utxos) {
-            if (utxo.address == addr && utxo.confirmations == 0) {
-                QBrush b;
-                b.setColor(Qt::red);
-                return b;
-            }
+        if (state->hasUnconfirmed(modeldata.at(index.row()))) {
+            QBrush b;
+            b.setColor(Qt::red);
+            return b;
         }
 
         // Else, just return the default brush
@@ -86,15 +108,15 @@ QVariant BalancesTableModel::data(const QModelIndex &index, int role) const
     
     if (role == Qt::DisplayRole) {
         switch (index.column()) {
-        case 0: return AddressBook::addLabelToAddress(std::get<0>(modeldata->at(index.row())));
-        case 1: return Settings::getDisplayFormat(std::get<1>(modeldata->at(index.row())));
+        case 0: return AddressBook::addLabelToAddress(modeldata.at(index.row()));
+        case 1: return Settings::getDisplayFormat(state->getBalance(modeldata.at(index.row())));
         }
     }
 
     if(role == Qt::ToolTipRole) {
         switch (index.column()) {
-        case 0: return AddressBook::addLabelToAddress(std::get<0>(modeldata->at(index.row())));
-        case 1: return Settings::getUSDFormat(std::get<1>(modeldata->at(index.row())));
+        case 0: return AddressBook::addLabelToAddress(modeldata.at(index.row()));
+        case 1: return Settings::getUSDFormat(state->getBalance(modeldata.at(index.row())));
         }
     }
     
@@ -2,14 +2,7 @@
 #define BALANCESTABLEMODEL_H
 
 #include "precompiled.h"
-
-struct UnspentOutput {
-    QString address;
-    QString txid;
-    QString amount;    
-    int     confirmations;
-    bool    spendable;
-};
+#include "walletstate.h"
 
 class BalancesTableModel : public QAbstractTableModel
 {
@@ -17,7 +10,7 @@ public:
     BalancesTableModel(QObject* parent);
     ~BalancesTableModel();
 
-    void setNewData(const QMap<QString, double>* balances, const QList<UnspentOutput>* outputs);
+    void setNewData(WalletStatePtr newState);
 
     int rowCount(const QModelIndex &parent) const;
     int columnCount(const QModelIndex &parent) const;
@@ -25,10 +18,11 @@ public:
     QVariant headerData(int section, Qt::Orientation orientation, int role) const;
 
 private:
-    QList<std::tuple<QString, double>>*    modeldata   = nullptr;    
-    QList<UnspentOutput>*                  utxos       = nullptr;  
+    // Addresses with a non zero balance, sorted. The balances are looked up in state.
+    QVector<QString>    modeldata;
+    WalletStatePtr      state;
 
     bool loading = true;
 };
 
-#endif // BALANCESTABLEMODEL_H
\ No newline at end of file
+#endif // BALANCESTABLEMODEL_H
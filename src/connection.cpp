@@ -37,6 +37,7 @@ ConnectionLoader::ConnectionLoader(MainWindow* main, RPC* rpc) {
 }
 
 ConnectionLoader::~ConnectionLoader() {
+    delete params;
     delete d;
     delete connD;
     main->logger->write("ConnectionLoader done");
@@ -232,68 +233,11 @@ void ConnectionLoader::createZcashConf() {
 
 
 void ConnectionLoader::downloadParams(std::function<void(void)> cb) {
-    main->logger->write("Adding params to download queue");
-    // Add all the files to the download queue
-    downloadQueue = new QQueue<QUrl>();
-    client = new QNetworkAccessManager(main);
+    main->logger->write("Downloading missing params");
+    delete params;
+    params = new ParamManager(main->logger, zcashParamsDir());
 
-    //Currently we fallback to this in rare edgecases, it's not normally executed
-    downloadQueue->enqueue(QUrl("https://z.cash/downloads/sapling-output.params"));
-    downloadQueue->enqueue(QUrl("https://z.cash/downloads/sapling-spend.params"));
-
-    doNextDownload(cb);
-}
-
-void ConnectionLoader::doNextDownload(std::function<void(void)> cb) {
-    auto fnSaveFileName = [&] (QUrl url) {
-        QString path = url.path();
-        QString basename = QFileInfo(path).fileName();
-
-        return basename;
-    };
-
-    if (downloadQueue->isEmpty()) {
-        delete downloadQueue;
-        client->deleteLater();
-
-        main->logger->write("All Downloads done");
-        this->showInformation(QObject::tr("All Downloads Finished Successfully!"));
-        cb();
-        return;
-    }
-
-    QUrl url = downloadQueue->dequeue();
-    int filesRemaining = downloadQueue->size();
-
-    QString filename = fnSaveFileName(url);
-    QString paramsDir = zcashParamsDir();
-
-    if (QFile(QDir(paramsDir).filePath(filename)).exists()) {
-        main->logger->write(filename + " already exists, skipping");
-        doNextDownload(cb);
-
-        return;
-    }
-
-    // The downloaded file is written to a new name, and then renamed when the operation completes.
-    currentOutput = new QFile(QDir(paramsDir).filePath(filename + ".part"));   
-
-    if (!currentOutput->open(QIODevice::WriteOnly)) {
-        main->logger->write("Couldn't open " + currentOutput->fileName() + " for writing");
-        this->showError(QObject::tr("Couldn't download params. Please check the help site for more info."));
-    }
-    main->logger->write("Downloading to " + filename);
-    qDebug() << "Downloading " << url << " to " << filename;
-    
-    QNetworkRequest request(url);
-    request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
-    currentDownload = client->get(request);
-    downloadTime.start();
-    
-    // Download Progress
-    QObject::connect(currentDownload, &QNetworkReply::downloadProgress, [=] (auto done, auto total) {
-        // calculate the download speed
-        double speed = done * 1000.0 / downloadTime.elapsed();
+    params->download(ParamManager::paramFiles(), [=] (const QString& filename, qint64 done, qint64 total, double speed, int filesRemaining) {
         QString unit;
         if (speed < 1024) {
             unit = "bytes/sec";
@@ -306,32 +250,17 @@ void ConnectionLoader::doNextDownload(std::function<void(void)> cb) {
         }
 
         this->showInformation(
-            QObject::tr("Downloading ") % filename % (filesRemaining > 1 ? " ( +" % QString::number(filesRemaining)  % QObject::tr(" more remaining )") : QString("")),
-            QString::number(done/1024/1024, 'f', 0) % QObject::tr("MB of ") % QString::number(total/1024/1024, 'f', 0) + QObject::tr("MB at ") % QString::number(speed, 'f', 2) % unit);
-    });
-    
-    // Download Finished
-    QObject::connect(currentDownload, &QNetworkReply::finished, [=] () {
-        // Rename file
-        main->logger->write("Finished downloading " + filename);
-        currentOutput->rename(QDir(paramsDir).filePath(filename));
-
-        currentOutput->close();
-        currentDownload->deleteLater();
-        currentOutput->deleteLater();
-
-        if (currentDownload->error()) {
-            main->logger->write("Downloading " + filename + " failed");
-            this->showError(QObject::tr("Downloading ") + filename + QObject::tr(" failed. Please check the help site for more info"));                
-        } else {
-            doNextDownload(cb);
+            QObject::tr("Downloading ") % filename % (filesRemaining > 0 ? " ( +" % QString::number(filesRemaining)  % QObject::tr(" more remaining )") : QString("")),
+            QString::number(done/1024/1024) % QObject::tr("MB of ") % (total > 0 ? QString::number(total/1024/1024) : QString("?")) + QObject::tr("MB at ") % QString::number(speed, 'f', 2) % unit);
+    }, [=] (bool ok, const QString& error) {
+        if (!ok) {
+            this->showError(QObject::tr("Couldn't download params. Please check the help site for more info.") % "\n\n" % error);
+            return;
         }
-    });
 
-    // Download new data available. 
-    QObject::connect(currentDownload, &QNetworkReply::readyRead, [=] () {
-        currentOutput->write(currentDownload->readAll());
-    });    
+        this->showInformation(QObject::tr("All Downloads Finished Successfully!"));
+        cb();
+    });
 }
 
 bool ConnectionLoader::startEmbeddedZcashd() {
@@ -469,10 +398,15 @@ Connection* ConnectionLoader::makeConnection(std::shared_ptr<ConnectionConfig> c
     request->setUrl(myurl);
     request->setHeader(QNetworkRequest::ContentTypeHeader, "text/plain");
     
+    // The request is made once, with the auth header already encoded, and reused for every call
     QString userpass = config.get()->rpcuser % ":" % config.get()->rpcpassword;
     QString headerData = "Basic " + userpass.toLocal8Bit().toBase64();
     request->setRawHeader("Authorization", headerData.toLocal8Bit());    
 
+    // Pipelining sends the next request on a socket before the previous reply is in. It's off
+    // unless turned on in the settings.
+    request->setAttribute(QNetworkRequest::HttpPipeliningAllowedAttribute, Settings::getInstance()->getRPCPipelining());
+
     return new Connection(main, client, request, config);
 }
 
@@ -606,39 +540,47 @@ QString ConnectionLoader::zcashParamsDir() {
 bool ConnectionLoader::verifyParams() {
     QDir paramsDir(zcashParamsDir());
 
-    // TODO: better error reporting if only 1 file exists or is missing
-    qDebug() << "Verifying sapling param files exist";
+    qDebug() << "Verifying sapling param files";
 
+    // Both files have to be in dir, and have the expected hashes. Files that passed before and
+    // haven't changed since aren't read again.
+    auto verified = [] (const QDir& dir) {
+        for (const auto& param : ParamManager::paramFiles()) {
+            if (!ParamManager::isVerified(dir.filePath(param.name), param))
+                return false;
+        }
+        return true;
+    };
 
     // This list of locations to look must be kept in sync with the list in hushd
-    if( QFile( QDir(".").filePath("sapling-output.params") ).exists() && QFile( QDir(".").filePath("sapling-spend.params") ).exists() ) {
+    if (verified(QDir("."))) {
         qDebug() << "Found params in .";
         return true;
     }
 
-    if( QFile( QDir("..").filePath("sapling-output.params") ).exists() && QFile( QDir("..").filePath("sapling-spend.params") ).exists() ) {
+    if (verified(QDir(".."))) {
         qDebug() << "Found params in ..";
         return true;
     }
 
-    if( QFile( QDir("..").filePath("hush3/sapling-output.params") ).exists() && QFile( QDir("..").filePath("hush3/sapling-spend.params") ).exists() ) {
+    if (verified(QDir("../hush3"))) {
         qDebug() << "Found params in ../hush3";
         return true;
     }
 
     // this is to support SD on mac in /Applications1
-    if( QFile( QDir("/Applications").filePath("silentdragon.app/Contents/MacOS/sapling-output.params") ).exists() && QFile( QDir("/Applications").filePath("./silentdragon.app/Contents/MacOS/sapling-spend.params") ).exists() ) {
+    if (verified(QDir("/Applications/silentdragon.app/Contents/MacOS"))) {
         qDebug() << "Found params in /Applications/silentdragon.app/Contents/MacOS";
         return true;
     }
 
     // this is to support SD on mac inside a DMG
-    if( QFile( QDir("./").filePath("silentdragon.app/Contents/MacOS/sapling-output.params") ).exists() && QFile( QDir("./").filePath("./silentdragon.app/Contents/MacOS/sapling-spend.params") ).exists() ) {
+    if (verified(QDir("./silentdragon.app/Contents/MacOS"))) {
         qDebug() << "Found params in ./silentdragon.app/Contents/MacOS";
         return true;
     }
 
-    if (QFile(paramsDir.filePath("sapling-output.params")).exists() && QFile(paramsDir.filePath("sapling-spend.params")).exists()) {
+    if (verified(paramsDir)) {
         qDebug() << "Found params in " << paramsDir;
         return true;
     }
@@ -754,9 +696,23 @@ Connection::Connection(MainWindow* m, QNetworkAccessManager* c, QNetworkRequest*
     this->request     = r;
     this->config      = conf;
     this->main        = m;
+
+    // QNetworkAccessManager opens at most 6 connections to a host, so spread the RPC calls over
+    // a few of them. All of them keep their sockets to hushd alive between calls.
+    rpcClients.push_back(restclient);
+    for (int i = 1; i < Settings::getInstance()->getRPCClients(); i++) {
+        rpcClients.push_back(new QNetworkAccessManager(main));
+    }
+
+    maxInFlight = std::max(Settings::getInstance()->getRPCMaxInFlight(), reservedSlots + 1);
 }
 
 Connection::~Connection() {
+    for (auto client : rpcClients) {
+        if (client != restclient)
+            delete client;
+    }
+
     delete restclient;
     delete request;
 }
@@ -768,21 +724,25 @@ void Connection::doRPC(const QJsonValue& payload, const std::function<void(QJson
         return;
     }
 
-    qDebug() << "RPC:" << payload["method"].toString() << payload;
+    logCall(payload);
+
+    // If the same call is already on its way, just wait for its reply
+    auto key = flightKey(payload);
+    if (!key.isNull()) {
+        if (rpcFlights.contains(key)) {
+            rpcFlights[key].push_back(qMakePair(cb, ne));
+            return;
+        }
+        rpcFlights[key].push_back(qMakePair(cb, ne));
+    }
 
     QJsonDocument jd_rpc_call(payload.toObject());
     QByteArray ba_rpc_call = jd_rpc_call.toJson();
 
-    QNetworkReply *reply = restclient->post(*request, ba_rpc_call);
+    auto method = payload["method"].toString();
 
-    QObject::connect(reply, &QNetworkReply::finished, [=] {
-        reply->deleteLater();
-        if (shutdownInProgress) {
-            // Ignoring callback because shutdown in progress
-            return;
-        }
-        
-        QJsonDocument jd_reply = QJsonDocument::fromJson(reply->readAll());
+    post(method, priorityFor(method), ba_rpc_call, [=] (QNetworkReply* reply, const QByteArray& all) {
+        QJsonDocument jd_reply = QJsonDocument::fromJson(all);
         QJsonValue parsed;
 
         if (jd_reply.isObject())
@@ -790,26 +750,122 @@ void Connection::doRPC(const QJsonValue& payload, const std::function<void(QJson
         else
             parsed = jd_reply.array();
 
-        if (reply->error() != QNetworkReply::NoError) {
-            ne(reply, parsed);
+        QList<QPair<RPCCallback, RPCErrorCallback>> waiters;
+        if (key.isNull()) {
+            waiters.push_back(qMakePair(cb, ne));
+        } else {
+            waiters = rpcFlights.take(key);
+        }
+
+        for (const auto& w : waiters) {
+            if (reply->error() != QNetworkReply::NoError) {
+                w.second(reply, parsed);
+                continue;
+            } 
+            
+            if (parsed.isNull()) {
+                w.second(reply, "Unknown error");
+            }
+            
+            w.first(parsed["result"]);
+        }
+        errorShownFor = nullptr;
+    });
+}
+
+void Connection::doRPCRaw(const QJsonValue& payload, const std::function<void(const QByteArray&)>& cb,
+                          const std::function<void(QNetworkReply*, const QJsonValue&)>& ne) {
+    if (shutdownInProgress) {
+        return;
+    }
+
+    logCall(payload);
+
+    auto key = flightKey(payload);
+    if (!key.isNull()) {
+        if (rawFlights.contains(key)) {
+            rawFlights[key].push_back(qMakePair(cb, ne));
             return;
-        } 
-        
-        if (parsed.isNull()) {
-            ne(reply, "Unknown error");
         }
-        
-        cb(parsed["result"]);        
+        rawFlights[key].push_back(qMakePair(cb, ne));
+    }
+
+    auto method = payload["method"].toString();
+
+    post(method, priorityFor(method), QJsonDocument(payload.toObject()).toJson(), [=] (QNetworkReply* reply, const QByteArray& all) {
+        QList<QPair<RawCallback, RPCErrorCallback>> waiters;
+        if (key.isNull()) {
+            waiters.push_back(qMakePair(cb, ne));
+        } else {
+            waiters = rawFlights.take(key);
+        }
+
+        // Only error replies are parsed here. They are small, and the error callbacks want the JSON.
+        QJsonValue parsed;
+        if (reply->error() != QNetworkReply::NoError) {
+            parsed = QJsonDocument::fromJson(all).object();
+        }
+
+        for (const auto& w : waiters) {
+            if (reply->error() != QNetworkReply::NoError) {
+                w.second(reply, parsed);
+            } else {
+                w.first(all);
+            }
+        }
+        errorShownFor = nullptr;
     });
 }
 
+// Only pay for serializing the payload if someone wants to see it
+void Connection::logCall(const QJsonValue& payload) {
+    if (main->logger->isEnabled(Logger::Debug))
+        main->logger->write(Logger::Debug, "RPC: " % payload["method"].toString() % " " %
+                            QJsonDocument(payload.toObject()).toJson(QJsonDocument::Compact));
+}
+
+/**
+ * Calls that only read state can share a reply with an identical call that's already in flight.
+ * Only the read-only calls the app makes are listed. Anything else, eg. a call that changes the
+ * wallet or hands out a new address each time, is always sent.
+ */
+QString Connection::flightKey(const QJsonValue& payload) {
+    static const QSet<QString> shared = {
+        "getinfo", "getblockchaininfo", "getnetworkinfo", "getnetworksolps", "getwalletinfo",
+        "getchaintxstats", "getblockhash", "getblockheader",
+        "z_gettotalbalance", "listunspent", "z_listunspent", "getaddressesbyaccount", "z_listaddresses",
+        "listsinceblock", "gettransaction", "z_listreceivedbyaddress", "z_getoperationstatus",
+        "validateaddress", "z_validateaddress"
+    };
+
+    auto method = payload["method"].toString();
+    if (!shared.contains(method))
+        return QString();
+
+    return method % "|" % QString::fromUtf8(QJsonDocument(payload["params"].toArray()).toJson(QJsonDocument::Compact));
+}
+
+void Connection::showRPCError(QNetworkReply* reply, const QJsonValue& parsed) {
+    if (reply == errorShownFor)
+        return;
+    errorShownFor = reply;
+
+    if (!parsed.isUndefined() && !parsed["error"].toObject()["message"].isNull()) {
+        this->showTxError(parsed["error"].toObject()["message"].toString());
+    } else {
+        this->showTxError(reply->errorString());
+    }
+}
+
 void Connection::doRPCWithDefaultErrorHandling(const QJsonValue& payload, const std::function<void(QJsonValue)>& cb) {
     doRPC(payload, cb, [=] (QNetworkReply* reply, const QJsonValue &parsed) {
-        if (!parsed.isUndefined() && !parsed["error"].toObject()["message"].isNull()) {
-            this->showTxError(parsed["error"].toObject()["message"].toString());
-        } else {
-            this->showTxError(reply->errorString());
-        }
+        showRPCError(reply, parsed);
+    });
+}
+
+void Connection::doRPCRawWithDefaultErrorHandling(const QJsonValue& payload, const std::function<void(const QByteArray&)>& cb) {
+    doRPCRaw(payload, cb, [=] (QNetworkReply* reply, const QJsonValue &parsed) {
+        showRPCError(reply, parsed);
     });
 }
 
@@ -819,6 +875,248 @@ void Connection::doRPCIgnoreError(const QJsonValue& payload, const std::function
     });
 }
 
+/**
+ * Send a list of calls, skipping the ones that are identical to a batch call that's already in
+ * flight (or to an earlier call in the same list). Those get the reply of the call they're
+ * identical to, so itemDone is still called once for every call.
+ */
+void Connection::doBatchPost(const QList<QJsonValue>& payloads, const BatchItemCallback& itemDone) {
+    if (shutdownInProgress) {
+        // Ignoring RPC because shutdown in progress
+        return;
+    }
+
+    QList<QJsonValue>   unique;
+    QList<QString>      uniqueKeys;
+    QList<int>          uniqueIndex;    // For calls that aren't shared, the index in payloads
+
+    for (int i = 0; i < payloads.size(); i++) {
+        auto key = flightKey(payloads[i]);
+        auto waiter = [=] (const QJsonValue& result, const QString& error) { itemDone(i, result, error); };
+
+        if (!key.isNull() && batchFlights.contains(key)) {
+            batchFlights[key].push_back(waiter);
+            continue;
+        }
+
+        if (!key.isNull())
+            batchFlights[key].push_back(waiter);
+
+        unique.push_back(payloads[i]);
+        uniqueKeys.push_back(key);
+        uniqueIndex.push_back(i);
+    }
+
+    if (unique.size() < payloads.size()) {
+        main->logger->write(Logger::Debug, QString::number(payloads.size() - unique.size()) %
+                            " batch calls are already in flight, sharing their replies");
+    }
+
+    if (unique.isEmpty())
+        return;
+
+    sendBatch(unique, [=] (int j, const QJsonValue& result, const QString& error) {
+        if (uniqueKeys[j].isNull()) {
+            itemDone(uniqueIndex[j], result, error);
+            return;
+        }
+
+        for (const auto& w : batchFlights.take(uniqueKeys[j])) {
+            w(result, error);
+        }
+    });
+}
+
+/**
+ * Send a list of calls as JSON-RPC batch arrays, at most Settings::getRPCBatchSize() calls per
+ * HTTP request. Each call's "id" is replaced by its index in the list, which is used to match the
+ * replies back up, since hushd is free to return them in any order.
+ * itemDone is called exactly once for every call, with either the result or a non-null error.
+ */
+void Connection::sendBatch(const QList<QJsonValue>& payloads, const BatchItemCallback& itemDone) {
+    int chunkSize = Settings::getInstance()->getRPCBatchSize();
+    if (!batchSupported || chunkSize <= 1) {
+        for (int i = 0; i < payloads.size(); i++) {
+            doSinglePost(payloads[i], i, itemDone);
+        }
+        return;
+    }
+
+    for (int start = 0; start < payloads.size(); start += chunkSize) {
+        int end = std::min(start + chunkSize, payloads.size());
+
+        QJsonArray batch;
+        for (int i = start; i < end; i++) {
+            QJsonObject call = payloads[i].toObject();
+            call["id"] = i;
+            batch.append(call);
+        }
+
+        if (main->logger->isEnabled(Logger::Debug))
+            main->logger->write(Logger::Debug, "RPC batch: " % QString::number(end - start) % " calls");
+
+        auto body   = QJsonDocument(batch).toJson(QJsonDocument::Compact);
+        auto firstMethod = payloads[start].toObject()["method"].toString();
+        QString method = firstMethod % " (batch)";
+
+        post(method, priorityFor(firstMethod), body, [=] (QNetworkReply* reply, const QByteArray& all) {
+            QJsonDocument parsed = QJsonDocument::fromJson(all);
+
+            if (parsed.isObject()) {
+                // hushd answered the whole array with a single error object, which means it
+                // doesn't understand batches. Stop batching, and send this chunk one by one.
+                main->logger->write(Logger::Warning, "Batch RPC rejected by hushd, falling back to single calls: " %
+                                    QString::fromUtf8(parsed.toJson(QJsonDocument::Compact)));
+                batchSupported = false;
+
+                for (int i = start; i < end; i++) {
+                    doSinglePost(payloads[i], i, itemDone);
+                }
+                return;
+            }
+
+            QString replyError = QObject::tr("No reply from hushd");
+            if (reply->error() != QNetworkReply::NoError && !parsed.isArray()) {
+                main->logger->write(Logger::Warning, "Batch RPC failed: " % reply->errorString());
+                replyError = reply->errorString();
+            }
+
+            // Unless the HTTP reply was an error, the request was metered as a success, so the
+            // calls that hushd failed are counted here
+            QSet<int> answered;
+            int failed = 0;
+            for (const auto& it : parsed.array()) {
+                int i = it.toObject()["id"].toInt(-1);
+                if (i < start || i >= end || answered.contains(i))
+                    continue;
+
+                answered.insert(i);
+                if (it.toObject()["error"].isObject()) {
+                    failed++;
+                    itemDone(i, {}, it.toObject()["error"].toObject()["message"].toString(""));
+                } else {
+                    itemDone(i, it.toObject()["result"], QString());
+                }
+            }
+            if (failed > 0 && reply->error() == QNetworkReply::NoError)
+                metrics.addErrors(method, failed);
+
+            // Anything hushd didn't answer (eg. because of a network error) is marked as failed
+            for (int i = start; i < end; i++) {
+                if (!answered.contains(i))
+                    itemDone(i, {}, replyError);
+            }
+        });
+    }
+}
+
+// Send one call of a batch as its own HTTP request. Used when hushd doesn't accept batch arrays.
+void Connection::doSinglePost(const QJsonValue& payload, int i, const BatchItemCallback& itemDone) {
+    QJsonDocument jd_rpc_call(payload.toObject());
+    QByteArray ba_rpc_call = jd_rpc_call.toJson();
+
+    auto method = payload["method"].toString();
+
+    post(method, priorityFor(method), ba_rpc_call, [=] (QNetworkReply* reply, const QByteArray& all) {
+        auto parsed = QJsonDocument::fromJson(all);
+
+        if (reply->error() != QNetworkReply::NoError) {
+            if (parsed["error"].isObject()) {
+                itemDone(i, {}, parsed["error"].toObject()["message"].toString(""));
+            } else {
+                itemDone(i, {}, reply->errorString());
+            }
+        } else {
+            if (parsed.isEmpty()) {
+                itemDone(i, {}, QObject::tr("Empty reply from hushd"));
+            } else {
+                itemDone(i, parsed["result"], QString());
+            }
+        }
+    });
+}
+
+RpcPriority Connection::priorityFor(const QString& method) {
+    static const QSet<QString> send = {
+        "z_sendmany", "sendtoaddress", "sendmany", "z_shieldcoinbase", "z_mergetoaddress",
+        "z_getoperationstatus", "z_getoperationresult"
+    };
+    static const QSet<QString> balance = {
+        "getinfo", "getbalance", "z_gettotalbalance", "listunspent", "z_listunspent",
+        "getblockchaininfo", "getnetworkinfo", "getnetworksolps", "getwalletinfo", "getchaintxstats",
+        "z_listaddresses", "getaddressesbyaccount"
+    };
+    static const QSet<QString> background = {
+        "listsinceblock", "listtransactions", "gettransaction", "z_listreceivedbyaddress", "z_viewtransaction"
+    };
+
+    if (send.contains(method))       return RpcPriority::Send;
+    if (balance.contains(method))    return RpcPriority::Balance;
+    if (background.contains(method)) return RpcPriority::Background;
+
+    // Anything else is only called when the user does something
+    return RpcPriority::User;
+}
+
+/**
+ * Queue an HTTP request to hushd. At most Settings::getRPCMaxInFlight() requests are waiting on
+ * hushd at any time, and the rest are sent in priority order as replies come in. Balance and
+ * background calls can't take the last two slots, so a send or a user action never waits
+ * behind a full window of history calls.
+ * done is called with the finished reply (which is deleted later), unless we're shutting down.
+ */
+void Connection::post(const QString& method, RpcPriority priority, const QByteArray& body, const PostCallback& done) {
+    queued[(int)priority].enqueue(PendingPost{ method, body, done });
+    sendQueued();
+}
+
+void Connection::setMaxInFlight(int max) {
+    Settings::getInstance()->setRPCMaxInFlight(max);
+    maxInFlight = std::max(max, reservedSlots + 1);
+
+    // A bigger window has room for more of the queued calls right away
+    sendQueued();
+}
+
+void Connection::sendQueued() {
+    while (!shutdownInProgress) {
+        int p = 0;
+        while (p <= (int)RpcPriority::Background && queued[p].isEmpty())
+            p++;
+
+        if (p > (int)RpcPriority::Background)
+            return;
+
+        int limit = p <= (int)RpcPriority::Send ? maxInFlight : maxInFlight - reservedSlots;
+        if (postsInFlight >= limit)
+            return;
+
+        auto next = queued[p].dequeue();
+        auto token = metrics.start(next.method, next.body.size());
+        postsInFlight++;
+
+        auto client = rpcClients[nextClient];
+        nextClient = (nextClient + 1) % rpcClients.size();
+
+        QNetworkReply *reply = client->post(*request, next.body);
+
+        QObject::connect(reply, &QNetworkReply::finished, [=] {
+            reply->deleteLater();
+            auto all = reply->readAll();
+            metrics.finish(next.method, token, all.size(), reply->error() != QNetworkReply::NoError);
+            postsInFlight--;
+
+            if (shutdownInProgress) {
+                // Ignoring callback because shutdown in progress
+                return;
+            }
+
+            next.done(reply, all);
+            sendQueued();
+        });
+    }
+}
+
 void Connection::showTxError(const QString& error) {
     if (error.isNull()) return;
 
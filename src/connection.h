@@ -3,6 +3,8 @@
 
 #include "mainwindow.h"
 #include "ui_connection.h"
+#include "rpcmetrics.h"
+#include "parammanager.h"
 #include "precompiled.h"
 
 class RPC;
@@ -55,7 +57,6 @@ private:
 
     bool verifyParams();
     void downloadParams(std::function<void(void)> cb);
-    void doNextDownload(std::function<void(void)> cb);
     bool startEmbeddedZcashd();
 
     void refreshZcashdState(Connection* connection, std::function<void(void)> refused);
@@ -73,12 +74,17 @@ private:
     MainWindow*             main;
     RPC*                    rpc;
 
-    QNetworkReply* currentDownload = nullptr;
-    QFile*         currentOutput   = nullptr;
-    QQueue<QUrl>*  downloadQueue   = nullptr;
+    ParamManager*           params = nullptr;
+};
 
-    QNetworkAccessManager* client  = nullptr; 
-    QTime downloadTime;
+/**
+ * Scheduling class of an RPC call. Lower values are sent first when calls are queued.
+ */
+enum class RpcPriority {
+    User = 0,       // Something the user just asked for, eg. a new address
+    Send,           // Sending a tx, and polling its operation status
+    Balance,        // The periodic refresh of the chain state, balances and UTXOs
+    Background      // Transaction history
 };
 
 /**
@@ -97,92 +103,125 @@ public:
 
     void shutdown();
 
+    // Change the options/rpcmaxinflight setting, and apply it to the calls still waiting
+    void setMaxInFlight(int max);
+
     void doRPC(const QJsonValue& payload, const std::function<void(QJsonValue)>& cb,
                const std::function<void(QNetworkReply*, const QJsonValue&)>& ne);
     void doRPCWithDefaultErrorHandling(const QJsonValue& payload, const std::function<void(QJsonValue)>& cb);
     void doRPCIgnoreError(const QJsonValue& payload, const std::function<void(QJsonValue)>& cb) ;
 
+    // Like doRPC, but cb gets the raw bytes of the whole reply, for calls whose replies are read
+    // with RpcReader. Errors are parsed as usual.
+    void doRPCRaw(const QJsonValue& payload, const std::function<void(const QByteArray&)>& cb,
+                  const std::function<void(QNetworkReply*, const QJsonValue&)>& ne);
+    void doRPCRawWithDefaultErrorHandling(const QJsonValue& payload, const std::function<void(const QByteArray&)>& cb);
+
     void showTxError(const QString& error);
 
+    const RpcMetrics& getMetrics() const { return metrics; }
+
     // Batch method. Note: Because of the template, it has to be in the header file. 
+    // cb is called once, as soon as the last reply has arrived. Calls that failed are left out of
+    // the map and reported to itemError instead (or just logged, if there is no itemError).
     template<class T>
     void doBatchRPC(const QList<T>& payloads,
                      std::function<QJsonValue(T)> payloadGenerator,
-                     std::function<void(QMap<T, QJsonValue>*)> cb) {
+                     std::function<void(QMap<T, QJsonValue>*)> cb,
+                     std::function<void(T, const QString&)> itemError = nullptr) {
         auto responses = new QMap<T, QJsonValue>(); // zAddr -> list of responses for each call.
         int totalSize = payloads.size();
         if (totalSize == 0)
             return;
 
-        // Keep track of all pending method calls, so as to prevent 
-        // any overlapping calls
-        static QMap<QString, bool> inProgress;
-
+        // Overlapping batches don't need to be skipped: calls that are identical to one that's
+        // already in flight share its reply (see doBatchPost)
         QString method = payloadGenerator(payloads[0])["method"].toString();
 
-        //if (inProgress.value(method, false)) {
-        //    qDebug() << "In progress batch, skipping";
-        //    return;
-        //}
-
+        // Generate all the payloads up front, so they can be packed into batch arrays. Replies
+        // come back tagged with the index of the payload they belong to.
+        QList<QJsonValue> calls;
         for (auto item: payloads) {
-            QJsonValue payload = payloadGenerator(item);
-            inProgress[method] = true;
-            
-            QJsonDocument jd_rpc_call(payload.toObject());
-            QByteArray ba_rpc_call = jd_rpc_call.toJson();
-
-            QNetworkReply *reply = restclient->post(*request, ba_rpc_call);
-
-            QObject::connect(reply, &QNetworkReply::finished, [=] {
-                reply->deleteLater();
-                if (shutdownInProgress) {
-                    // Ignoring callback because shutdown in progress
-                    return;
-                }
-                
-                auto all = reply->readAll();            
-                auto parsed = QJsonDocument::fromJson(all);
-
-                if (reply->error() != QNetworkReply::NoError) {            
-                    qDebug() << parsed.toJson();
-                    qDebug() << reply->errorString();
-
-                    (*responses)[item] = {};    // Empty object
-                } else {
-                    if (parsed.isEmpty()) {
-                        (*responses)[item] = {};    // Empty object
-                    } else {
-                        (*responses)[item] = parsed["result"];
-                    }
-                }
-            });
+            calls.push_back(payloadGenerator(item));
         }
 
-        auto waitTimer = new QTimer(main);
-        QObject::connect(waitTimer, &QTimer::timeout, [=]() {
-            if (shutdownInProgress) {
-                waitTimer->stop();
-                waitTimer->deleteLater();  
-                return;
+        // Count down the outstanding replies. This counts calls rather than map entries, so 
+        // duplicate items in payloads don't stall the batch.
+        auto remaining = std::make_shared<QAtomicInt>(totalSize);
+
+        doBatchPost(calls, [=] (int i, const QJsonValue& result, const QString& error) {
+            if (error.isNull()) {
+                (*responses)[payloads[i]] = result;
+            } else if (itemError) {
+                itemError(payloads[i], error);
+            } else {
+                main->logger->write(method % " failed in batch: " % error);
             }
 
-            // If all responses have arrived, return
-            if (responses->size() == totalSize) {
-
-                waitTimer->stop();
-                
+            if (!remaining->deref()) {
                 cb(responses);
-                inProgress[method] = false;
-
-                waitTimer->deleteLater();            
             }
         });
-        waitTimer->start(100);    
     }
 
 private:
+    typedef std::function<void(int, const QJsonValue&, const QString&)> BatchItemCallback;
+    typedef std::function<void(QNetworkReply*, const QByteArray&)>      PostCallback;
+    typedef std::function<void(QJsonValue)>                             RPCCallback;
+    typedef std::function<void(QNetworkReply*, const QJsonValue&)>      RPCErrorCallback;
+    typedef std::function<void(const QByteArray&)>                      RawCallback;
+    typedef std::function<void(const QJsonValue&, const QString&)>      FlightCallback;
+
+    struct PendingPost {
+        QString         method;
+        QByteArray      body;
+        PostCallback    done;
+    };
+
+    static RpcPriority priorityFor(const QString& method);
+
+    void logCall(const QJsonValue& payload);
+    void showRPCError(QNetworkReply* reply, const QJsonValue& parsed);
+
+    void post(const QString& method, RpcPriority priority, const QByteArray& body, const PostCallback& done);
+    void sendQueued();
+
+    void doBatchPost(const QList<QJsonValue>& payloads, const BatchItemCallback& itemDone);
+    void doSinglePost(const QJsonValue& payload, int i, const BatchItemCallback& itemDone);
+    void sendBatch(const QList<QJsonValue>& payloads, const BatchItemCallback& itemDone);
+
+    // Key that identical calls share, or a null string if the call must not be shared
+    static QString flightKey(const QJsonValue& payload);
+
     bool shutdownInProgress = false;    
+
+    RpcMetrics metrics;
+
+    // Callbacks of the calls that are in flight, by flightKey(). A call that's identical to one
+    // of these is not sent again, it just waits for the same reply.
+    QHash<QString, QList<QPair<RPCCallback, RPCErrorCallback>>> rpcFlights;
+    QHash<QString, QList<FlightCallback>>                       batchFlights;
+    QHash<QString, QList<QPair<RawCallback, RPCErrorCallback>>> rawFlights;
+
+    // The reply whose callers are being called, once showRPCError has shown its error. Everyone
+    // waiting on the same reply gets the same error, so it's only shown once.
+    QNetworkReply*                  errorShownFor = nullptr;
+
+    // restclient, and the extra clients the calls are spread over round robin
+    QList<QNetworkAccessManager*>   rpcClients;
+    int                             nextClient = 0;
+
+    // Calls waiting for a free slot, one queue per RpcPriority
+    QQueue<PendingPost> queued[4];
+    int                 postsInFlight = 0;
+    int                 maxInFlight   = 0;      // Settings::getRPCMaxInFlight(), read once
+
+    // Slots that only sends and user actions may use
+    static const int    reservedSlots = 2;
+
+    // Set to false the first time hushd refuses a batch array, after which batches
+    // are sent as individual calls.
+    bool batchSupported     = true;
 };
 
 #endif
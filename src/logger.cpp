@@ -1,31 +1,187 @@
 #include "logger.h"
 
+struct LogEntry {
+    qint64      msecs;
+    int         level;
+    QString     text;
+};
+
+/**
+ * Bounded multi-producer, single-consumer queue. Every slot has a sequence number that says
+ * whether it's free for the producer at that position, or filled for the consumer. Producers
+ * claim a position with a CAS on head, so no one ever takes a lock.
+ */
+class LogRing {
+public:
+    explicit LogRing(size_t capacity) : mask(capacity - 1), slots(capacity) {
+        Q_ASSERT((capacity & mask) == 0);
+        for (size_t i = 0; i < capacity; i++)
+            slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    // Returns false if the ring is full
+    bool push(LogEntry&& entry) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots[pos & mask];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->entry = std::move(entry);
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Only called from the writer thread
+    bool pop(LogEntry& entry) {
+        Slot& slot = slots[tail & mask];
+        if (slot.seq.load(std::memory_order_acquire) != tail + 1)
+            return false;
+
+        entry = std::move(slot.entry);
+        slot.entry.text = QString();
+        slot.seq.store(tail + mask + 1, std::memory_order_release);
+        tail++;
+        return true;
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t>  seq;
+        LogEntry             entry;
+    };
+
+    const size_t            mask;
+    std::vector<Slot>       slots;
+    std::atomic<size_t>     head { 0 };
+    size_t                  tail = 0;
+};
+
 Logger::Logger(QObject *parent, QString fileName) : QObject(parent) {
-    m_showDate = true;
+    this->fileName = fileName;
+    minLevel = QSettings().value("options/loglevel", Info).toInt();
+    dropped  = 0;
+    stopping = false;
 
     if (!fileName.isEmpty()) {
-        file = new QFile;
-        file->setFileName(fileName);
-        file->open(QIODevice::Append | QIODevice::Text);
+        ring   = new LogRing(4096);
+        writer = std::thread([=] () { writerLoop(); });
     }
-    
+
     write("=========Startup==========");
 }
 
 void Logger::write(const QString &value) {
-    if (!file)
+    write(Info, value);
+}
+
+void Logger::write(Level level, const QString &value) {
+    if (!ring || !isEnabled(level))
+        return;
+
+    if (!ring->push(LogEntry{ QDateTime::currentMSecsSinceEpoch(), level, value })) {
+        dropped++;
         return;
-        
-    QString text = value;
-    text = QDateTime::currentDateTime().toString("dd.MM.yyyy hh:mm:ss ") + text;
-    QTextStream out(file);
-    out.setCodec("UTF-8");
-    if (file != 0) {
-        out << text << endl;
     }
+
+    // Errors are written right away, everything else waits for the next batch
+    if (level >= Error)
+        wakeCond.notify_one();
+}
+
+void Logger::openFile() {
+    file = new QFile(fileName);
+    file->open(QIODevice::Append | QIODevice::Text);
+    fileSize = file->size();
+
+    // A file carried over from an earlier run is rotated on the day it was last written
+    fileDate = fileSize > 0 ? QFileInfo(fileName).lastModified().date() : QDate::currentDate();
+}
+
+// SilentDragon.log -> SilentDragon.1.log -> ... -> SilentDragon.<keepFiles>.log, which is deleted
+void Logger::rotate() {
+    file->close();
+    delete file;
+
+    QFileInfo info(fileName);
+    auto numbered = [=] (int n) {
+        return info.dir().filePath(info.completeBaseName() % "." % QString::number(n) % "." % info.suffix());
+    };
+
+    QFile::remove(numbered(keepFiles));
+    for (int n = keepFiles - 1; n >= 1; n--)
+        QFile::rename(numbered(n), numbered(n + 1));
+    QFile::rename(fileName, numbered(1));
+
+    openFile();
+}
+
+void Logger::writerLoop() {
+    static const char* levelNames[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+    openFile();
+
+    QByteArray batch;
+    LogEntry entry;
+    while (true) {
+        bool stop = stopping;
+
+        int lost = dropped.exchange(0);
+        if (lost > 0) {
+            batch.append(QDateTime::currentDateTime().toString("dd.MM.yyyy hh:mm:ss ").toUtf8())
+                 .append("WARN  Log buffer full, dropped " + QByteArray::number(lost) + " lines\n");
+        }
+
+        while (ring->pop(entry)) {
+            batch.append(QDateTime::fromMSecsSinceEpoch(entry.msecs).toString("dd.MM.yyyy hh:mm:ss ").toUtf8())
+                 .append(QByteArray(levelNames[entry.level]).leftJustified(6, ' '))
+                 .append(entry.text.toUtf8())
+                 .append('\n');
+        }
+
+        if (!batch.isEmpty()) {
+            if (fileSize + batch.size() > maxFileSize || fileDate != QDate::currentDate())
+                rotate();
+
+            file->write(batch);
+            file->flush();
+            fileSize += batch.size();
+            batch.clear();
+        }
+
+        // Everything that was written before stop was asked for is now on disk
+        if (stop)
+            break;
+
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        wakeCond.wait_for(lock, std::chrono::milliseconds(flushInterval));
+    }
+
+    file->close();
+    delete file;
+    file = nullptr;
 }
 
 Logger::~Logger() {
-    if (file != 0)
-        file->close();
-}
\ No newline at end of file
+    if (writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            stopping = true;
+        }
+        wakeCond.notify_one();
+        writer.join();
+    }
+
+    delete ring;
+}
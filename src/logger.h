@@ -3,16 +3,55 @@
 
 #include "precompiled.h"
 
+class LogRing;
+
+/**
+ * Asynchronous file logger. write() only puts the line into a lock-free ring buffer, and a
+ * writer thread formats the lines, writes them in batches and rotates the file. If the buffer
+ * is full the line is dropped (and counted) rather than making the caller wait.
+ */
 class Logger : public QObject
 {
   Q_OBJECT
 public:
+  enum Level {
+      Debug = 0,
+      Info,
+      Warning,
+      Error
+  };
+
   explicit Logger(QObject *parent, QString fileName);
   ~Logger();
 
+  // Lines below this level are dropped right away. Read from "options/loglevel" at startup.
+  void  setLevel(Level level)               { minLevel = level; }
+  bool  isEnabled(Level level) const        { return level >= minLevel; }
+
+  void  write(Level level, const QString &value);
+
 private:
-  QFile *file      = nullptr;
-  bool m_showDate;
+  void  writerLoop();
+  void  openFile();
+  void  rotate();
+
+  QString               fileName;
+  QFile*                file        = nullptr;     // Only used by the writer thread
+  qint64                fileSize    = 0;
+  QDate                 fileDate;
+
+  LogRing*              ring        = nullptr;
+  std::atomic<int>      minLevel;
+  std::atomic<int>      dropped;
+  std::atomic<bool>     stopping;
+
+  std::thread           writer;
+  std::mutex            wakeMutex;
+  std::condition_variable wakeCond;
+
+  static const qint64   maxFileSize   = 10 * 1024 * 1024;
+  static const int      keepFiles     = 5;
+  static const int      flushInterval = 250;       // ms
 
 signals:
 
@@ -20,4 +59,4 @@ public slots:
   void write(const QString &value);
 };
 
-#endif // LOGGER_H
\ No newline at end of file
+#endif // LOGGER_H
@@ -18,6 +18,7 @@
 #include "settings.h"
 #include "version.h"
 #include "senttxstore.h"
+#include "txcache.h"
 #include "connection.h"
 #include "requestdialog.h"
 #include "websockets.h"
@@ -197,6 +198,9 @@ void MainWindow::closeEvent(QCloseEvent* event) {
     s.setValue("baltablegeometry", ui->balancesTable->horizontalHeader()->saveState());
     s.setValue("tratablegeometry", ui->transactionsTable->horizontalHeader()->saveState());
 
+    // Don't lose the mobile app's nonce if it hasn't been checkpointed yet
+    AppDataServer::getInstance()->checkpointNonces();
+
     s.sync();
 
     // Let the RPC know to shut down any running service.
@@ -295,6 +299,7 @@ void MainWindow::setupSettingsModal() {
                 "Shielded z-Address transactions are stored locally in your wallet, outside hushd. You may delete this saved information safely any time for your privacy.\nDo you want to delete the saved shielded transactions now?",
                 QMessageBox::Yes, QMessageBox::Cancel)) {
                     SentTxStore::deleteHistory();
+                    TxCache::deleteCache();
                     // Reload after the clear button so existing txs disappear
                     rpc->refresh(true);
             }
@@ -1135,6 +1140,20 @@ void MainWindow::setupBalancesTab() {
 
 void MainWindow::setupHushTab() {
     ui->hushlogo->setBasePixmap(QPixmap(":/img/res/zcashdlogo.gif"));
+
+    // RPC statistics, filled in by RPC::refreshRpcMetrics()
+    auto metricsBox = new QGroupBox(tr("RPC statistics"), ui->tab_5);
+    auto metricsLayout = new QVBoxLayout(metricsBox);
+
+    rpcMetricsTable = new QTableWidget(0, 8, metricsBox);
+    rpcMetricsTable->setHorizontalHeaderLabels({ tr("Method"), tr("Calls"), tr("Errors"), tr("In flight"),
+                                                 tr("p50 (ms)"), tr("p95 (ms)"), tr("p99 (ms)"), tr("KB in/out") });
+    rpcMetricsTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    rpcMetricsTable->verticalHeader()->setVisible(false);
+    rpcMetricsTable->horizontalHeader()->setSectionResizeMode(0, QHeaderView::Stretch);
+    metricsLayout->addWidget(rpcMetricsTable);
+
+    ui->verticalLayout_7->addWidget(metricsBox);
 }
 /*
 void MainWindow::setupChatTab() {
@@ -1314,13 +1333,14 @@ std::function<void(bool)> MainWindow::addZAddrsToComboList(bool sapling) {
     return [=] (bool checked) {
         if (checked && this->rpc->getAllZAddresses() != nullptr) {
             auto addrs = this->rpc->getAllZAddresses();
+            auto state = this->rpc->getWalletState();
             ui->listReceiveAddresses->clear();
 
             std::for_each(addrs->begin(), addrs->end(), [=] (auto addr) {
                 if ( (sapling &&  Settings::getInstance()->isSaplingAddress(addr)) ||
                     (!sapling && !Settings::getInstance()->isSaplingAddress(addr))) {
-                        if (rpc->getAllBalances()) {
-                            auto bal = rpc->getAllBalances()->value(addr);
+                        if (state) {
+                            auto bal = state->getBalance(addr);
                             ui->listReceiveAddresses->addItem(addr, bal);
                         }
                 }
@@ -1355,7 +1375,7 @@ void MainWindow::setupReceiveTab() {
     // Connect t-addr radio button
     QObject::connect(ui->rdioTAddr, &QRadioButton::toggled, [=] (bool checked) {
         qDebug() << "taddr radio toggled";
-        if (checked && this->rpc->getUTXOs() != nullptr) {
+        if (checked && this->rpc->getWalletState() != nullptr) {
             updateTAddrCombo(checked);
         }
 
@@ -1458,7 +1478,8 @@ void MainWindow::setupReceiveTab() {
         }
 
         ui->rcvLabel->setText(label);
-        ui->rcvBal->setText(Settings::getZECUSDDisplayFormat(rpc->getAllBalances()->value(addr)));
+        auto state = rpc->getWalletState();
+        ui->rcvBal->setText(Settings::getZECUSDDisplayFormat(state ? state->getBalance(addr) : 0));
         ui->txtReceive->setPlainText(addr);
         ui->qrcodeDisplay->setQrcodeString(addr);
         if (rpc->getUsedAddresses()->value(addr, false)) {
@@ -1518,16 +1539,17 @@ void MainWindow::setupReceiveTab() {
 
 void MainWindow::updateTAddrCombo(bool checked) {
     if (checked) {
-        auto utxos = this->rpc->getUTXOs();
+        auto state = this->rpc->getWalletState();
         ui->listReceiveAddresses->clear();
+        if (!state)
+            return;
 
-        std::for_each(utxos->begin(), utxos->end(), [=](auto& utxo) {
-            auto addr = utxo.address;
-            if (addr.startsWith("R") && ui->listReceiveAddresses->findText(addr) < 0) {
-                auto bal = rpc->getAllBalances()->value(addr);
-                ui->listReceiveAddresses->addItem(addr, bal);
+        // The addresses in the wallet state are already unique
+        for (const auto& addr : state->getAddresses()) {
+            if (addr.startsWith("R")) {
+                ui->listReceiveAddresses->addItem(addr, state->getBalance(addr));
             }
-        });
+        }
     }
 };
 
@@ -66,6 +66,7 @@ public:
     QLabel*             statusIcon;
     QLabel*             loadingLabel;
     QWidget*            zcashdtab;
+    QTableWidget*       rpcMetricsTable;
 
     Logger*      logger;
 
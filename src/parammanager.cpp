@@ -0,0 +1,407 @@
+#include "parammanager.h"
+#include "logger.h"
+
+ParamManager::ParamManager(Logger* logger, const QString& dir) {
+    this->logger = logger;
+    this->dir    = dir;
+
+    client = new QNetworkAccessManager();
+}
+
+ParamManager::~ParamManager() {
+    stopReplies();
+    delete output;
+
+    // A reply may still be emitting a signal, so the client can't go away right now
+    client->deleteLater();
+}
+
+const QList<ParamFile>& ParamManager::paramFiles() {
+    static const QList<ParamFile> files = {
+        { "sapling-output.params", QUrl("https://z.cash/downloads/sapling-output.params"),
+          "2f0ebbcbb9bb0bcffe95a397e7eba89c29eb4dde6191c339db88570e3f3fb0e4" },
+        { "sapling-spend.params",  QUrl("https://z.cash/downloads/sapling-spend.params"),
+          "8e48ffd23abb3a5fd9c5589204f32d9c31285a04b78096ba40a79b75677efc13" }
+    };
+    return files;
+}
+
+bool ParamManager::isVerified(const QString& path, const ParamFile& param) {
+    QFileInfo info(path);
+    if (!info.exists())
+        return false;
+
+    // A file that's the same as when it was last hashed has the same result
+    QSettings s;
+    auto stamp = stampOf(info);
+    if (s.value("params/verified").toMap().value(info.absoluteFilePath()).toString() == stamp)
+        return true;
+    if (s.value("params/failed").toMap().value(info.absoluteFilePath()).toString() == stamp)
+        return false;
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    qDebug() << "Hashing " << path;
+    crypto_hash_sha256_state state;
+    crypto_hash_sha256_init(&state);
+    if (!hashFile(&file, info.size(), &state))
+        return false;
+
+    if (toHex(&state) != param.sha256) {
+        qDebug() << path << " doesn't have the expected hash";
+        saveStamp(path, false);
+        return false;
+    }
+
+    saveStamp(path, true);
+    return true;
+}
+
+QString ParamManager::stampOf(const QFileInfo& info) {
+    return QString::number(info.size()) % ":" % QString::number(info.lastModified().toMSecsSinceEpoch());
+}
+
+// Remember the file's hash check under its size and modification time, in place of any earlier one
+void ParamManager::saveStamp(const QString& path, bool passed) {
+    QFileInfo info(path);
+
+    QSettings s;
+    auto verified = s.value("params/verified").toMap();
+    auto failed   = s.value("params/failed").toMap();
+    verified.remove(info.absoluteFilePath());
+    failed.remove(info.absoluteFilePath());
+
+    (passed ? verified : failed)[info.absoluteFilePath()] = stampOf(info);
+    s.setValue("params/verified", verified);
+    s.setValue("params/failed", failed);
+}
+
+// Feeds the next length bytes of file into the hash
+bool ParamManager::hashFile(QFile* file, qint64 length, crypto_hash_sha256_state* state) {
+    QByteArray buf(1024 * 1024, Qt::Uninitialized);
+    while (length > 0) {
+        qint64 n = file->read(buf.data(), qMin<qint64>(buf.size(), length));
+        if (n <= 0)
+            return false;
+
+        crypto_hash_sha256_update(state, reinterpret_cast<const unsigned char*>(buf.constData()), (unsigned long long)n);
+        length -= n;
+    }
+    return true;
+}
+
+QByteArray ParamManager::toHex(crypto_hash_sha256_state* state) {
+    unsigned char hash[crypto_hash_sha256_BYTES];
+    crypto_hash_sha256_final(state, hash);
+
+    char hex[crypto_hash_sha256_BYTES * 2 + 1];
+    sodium_bin2hex(hex, sizeof(hex), hash, crypto_hash_sha256_BYTES);
+    return QByteArray(hex);
+}
+
+void ParamManager::download(const QList<ParamFile>& files,
+                            std::function<void(const QString&, qint64, qint64, double, int)> progress,
+                            std::function<void(bool, const QString&)> done) {
+    progressCb = progress;
+    doneCb     = done;
+
+    queue.clear();
+    for (const auto& param : files)
+        queue.enqueue(param);
+
+    startNext();
+}
+
+void ParamManager::startNext() {
+    while (!queue.isEmpty()) {
+        current = queue.dequeue();
+
+        auto target = QDir(dir).filePath(current.name);
+        if (isVerified(target, current)) {
+            logger->write(current.name + " already exists, skipping");
+            continue;
+        }
+        if (QFile::exists(target))
+            logger->write(Logger::Warning, current.name + " doesn't have the expected hash, downloading it again");
+
+        // The size, and whether the server takes ranges, decide how the file is split up
+        QNetworkRequest request(current.url);
+        request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+        headReply = client->head(request);
+        QObject::connect(headReply, &QNetworkReply::finished, [=] () {
+            auto reply = headReply;
+            headReply = nullptr;
+            reply->deleteLater();
+
+            startFile(reply);
+        });
+        return;
+    }
+
+    logger->write("All Downloads done");
+    auto cb = doneCb;
+    cb(true, QString());
+}
+
+void ParamManager::startFile(QNetworkReply* head) {
+    // Some servers don't answer HEAD, the file is then fetched in one go
+    auto length = head->header(QNetworkRequest::ContentLengthHeader);
+    if (head->error()) {
+        logger->write(Logger::Warning, "HEAD " + current.url.toString() + " failed: " + head->errorString());
+        length = QVariant();
+    }
+
+    total  = length.isValid() ? length.toLongLong() : -1;
+    ranges = total > 0 && head->rawHeader("Accept-Ranges").trimmed().toLower() == "bytes";
+
+    // Without ranges there's no way to carry on from an earlier .part file
+    output = new QFile(QDir(dir).filePath(current.name + ".part"));
+    qint64 resumeFrom = ranges ? output->size() : 0;
+    if (resumeFrom > total)
+        resumeFrom = 0;
+
+    bool opened = resumeFrom > 0 ? output->open(QIODevice::ReadWrite)
+                                 : output->open(QIODevice::WriteOnly | QIODevice::Truncate);
+    if (!opened) {
+        fail(QObject::tr("Couldn't open %1 for writing").arg(output->fileName()));
+        return;
+    }
+
+    // What's already on disk is hashed once, and the download carries on right after it
+    crypto_hash_sha256_init(&hashState);
+    if (resumeFrom > 0) {
+        logger->write("Resuming " + current.name + " at " + QString::number(resumeFrom) + " bytes");
+        if (!hashFile(output, resumeFrom, &hashState)) {
+            fail(QObject::tr("Couldn't read %1").arg(output->fileName()));
+            return;
+        }
+    }
+
+    logger->write("Downloading " + current.url.toString() + (ranges ? " in chunks" : ""));
+    resumed    = resumeFrom > 0;
+    written    = resumeFrom;
+    nextOffset = resumeFrom;
+    fetched    = 0;
+    fileTime.start();
+
+    if (ranges && written == total) {
+        finishFile();
+        return;
+    }
+
+    fill();
+}
+
+// Starts chunks until maxStreams are being downloaded or waiting to be written
+void ParamManager::fill() {
+    // Without ranges the whole file is one chunk
+    qint64 end = ranges ? total : std::numeric_limits<qint64>::max();
+    while (chunks.size() < maxStreams && nextOffset < end) {
+        Chunk* chunk = new Chunk();
+        chunk->next = nextOffset;
+        chunk->end  = ranges ? qMin(nextOffset + chunkSize, total) : end;
+
+        nextOffset = chunk->end;
+        chunks.append(chunk);
+        request(chunk);
+    }
+}
+
+void ParamManager::request(Chunk* chunk) {
+    QNetworkRequest request(current.url);
+    request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+    if (ranges)
+        request.setRawHeader("Range", "bytes=" + QByteArray::number(chunk->next) + "-" + QByteArray::number(chunk->end - 1));
+
+    chunk->reply = client->get(request);
+    QObject::connect(chunk->reply, &QNetworkReply::readyRead, [=] () { onData(chunk); });
+    QObject::connect(chunk->reply, &QNetworkReply::finished,  [=] () { onFinished(chunk); });
+}
+
+// Returns false if the download was stopped, in which case chunk is gone
+bool ParamManager::onData(Chunk* chunk) {
+    auto reply  = chunk->reply;
+    int  status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    auto data   = reply->readAll();
+
+    // An error page isn't part of the file. The error itself is seen when the reply finishes.
+    if (status < 200 || status >= 300)
+        return true;
+
+    // Some servers say they take ranges, but send the whole file anyway
+    if (ranges && status == 200) {
+        restartWithoutRanges();
+        return false;
+    }
+
+    // A server that ignores the range sends the whole file from the start
+    if ((ranges && status != 206) || data.size() > chunk->end - chunk->next) {
+        fail(QObject::tr("The server sent unexpected data for %1").arg(current.name));
+        return false;
+    }
+
+    chunk->next += data.size();
+    chunk->data.append(data);
+    fetched += data.size();
+
+    qint64 buffered = 0;
+    for (const Chunk* c : chunks)
+        buffered += c->data.size();
+    progressCb(current.name, written + buffered, total,
+               fetched * 1000.0 / qMax<qint64>(1, fileTime.elapsed()), queue.size());
+
+    if (chunk == chunks.first())
+        return flush();
+    return true;
+}
+
+void ParamManager::onFinished(Chunk* chunk) {
+    auto reply = chunk->reply;
+    if (!onData(chunk))
+        return;
+
+    chunk->reply = nullptr;
+    reply->deleteLater();
+
+    if (reply->error() || (ranges && chunk->next != chunk->end)) {
+        // Only the missing part of the chunk is asked for again
+        if (ranges && ++chunk->attempts < maxAttempts) {
+            logger->write(Logger::Warning, "Retrying " + current.name + " from " + QString::number(chunk->next) +
+                                                 ": " + reply->errorString());
+            request(chunk);
+            return;
+        }
+
+        fail(QObject::tr("Downloading %1 failed: %2").arg(current.name, reply->errorString()));
+        return;
+    }
+
+    if (!ranges) {
+        chunk->end = chunk->next;
+        total      = chunk->next;
+    }
+
+    flush();
+}
+
+// Writes and hashes everything that's contiguous with the end of the .part file
+bool ParamManager::flush() {
+    while (!chunks.isEmpty()) {
+        Chunk* chunk = chunks.first();
+        if (!chunk->data.isEmpty()) {
+            if (output->write(chunk->data) != chunk->data.size()) {
+                fail(QObject::tr("Couldn't write to %1").arg(output->fileName()));
+                return false;
+            }
+            crypto_hash_sha256_update(&hashState, reinterpret_cast<const unsigned char*>(chunk->data.constData()),
+                                      (unsigned long long)chunk->data.size());
+            written += chunk->data.size();
+            chunk->data.clear();
+        }
+
+        if (chunk->reply != nullptr || chunk->next != chunk->end)
+            break;
+
+        chunks.removeFirst();
+        delete chunk;
+    }
+
+    if (chunks.isEmpty() && (!ranges || nextOffset >= total)) {
+        finishFile();
+        return false;
+    }
+
+    fill();
+    return true;
+}
+
+void ParamManager::finishFile() {
+    auto hash = toHex(&hashState);
+    auto part = output->fileName();
+    output->close();
+    delete output;
+    output = nullptr;
+
+    auto target = QDir(dir).filePath(current.name);
+    if (hash != current.sha256) {
+        QFile::remove(part);
+
+        // The earlier run may have left something bad behind, so get the whole file once more
+        if (resumed) {
+            logger->write(Logger::Warning, current.name + " doesn't have the expected hash, starting over");
+            queue.prepend(current);
+            startNext();
+            return;
+        }
+
+        fail(QObject::tr("%1 is corrupt, its SHA-256 hash doesn't match").arg(current.name));
+        return;
+    }
+
+    QFile::remove(target);
+    if (!QFile::rename(part, target)) {
+        fail(QObject::tr("Couldn't rename %1 to %2").arg(part, target));
+        return;
+    }
+
+    saveStamp(target, true);
+    logger->write("Finished downloading " + current.name);
+    startNext();
+}
+
+// Starts the file over as a single download from the first byte
+void ParamManager::restartWithoutRanges() {
+    logger->write(Logger::Warning, current.url.toString() + " ignored the Range request, downloading it in one go");
+    stopReplies();
+
+    if (!output->resize(0) || !output->seek(0)) {
+        fail(QObject::tr("Couldn't write to %1").arg(output->fileName()));
+        return;
+    }
+
+    crypto_hash_sha256_init(&hashState);
+    ranges     = false;
+    resumed    = false;
+    written    = 0;
+    nextOffset = 0;
+    fetched    = 0;
+
+    fill();
+}
+
+void ParamManager::fail(const QString& error) {
+    stopReplies();
+
+    // The .part file stays, so the next try carries on from where this one stopped
+    if (output != nullptr) {
+        output->close();
+        delete output;
+        output = nullptr;
+    }
+
+    logger->write(Logger::Error, error);
+    auto cb = doneCb;
+    cb(false, error);
+}
+
+void ParamManager::stopReplies() {
+    auto stop = [] (QNetworkReply* reply) {
+        QObject::disconnect(reply, nullptr, nullptr, nullptr);
+        reply->abort();
+        reply->deleteLater();
+    };
+
+    if (headReply != nullptr) {
+        stop(headReply);
+        headReply = nullptr;
+    }
+
+    for (Chunk* chunk : chunks) {
+        if (chunk->reply != nullptr)
+            stop(chunk->reply);
+        delete chunk;
+    }
+    chunks.clear();
+}
@@ -0,0 +1,95 @@
+#ifndef PARAMMANAGER_H
+#define PARAMMANAGER_H
+
+#include "precompiled.h"
+
+class Logger;
+
+struct ParamFile {
+    QString     name;
+    QUrl        url;
+    QByteArray  sha256;         // Hex
+};
+
+/**
+ * Checks and downloads the Sapling params.
+ *
+ * A file is downloaded in chunks over several HTTP Range requests at once, but it is written to
+ * its .part file, and hashed, strictly in order. Chunks that arrive early wait in memory, and only
+ * a few chunks past the write position are ever requested, so that memory stays bounded. An
+ * interrupted download resumes from the end of its .part file. A server that doesn't take ranges
+ * after all gets the file asked for in one go.
+ *
+ * The result of each hash check is remembered with the file's size and modification time, so later
+ * startups don't read the file again, whether it passed or not.
+ */
+class ParamManager {
+public:
+    ParamManager(Logger* logger, const QString& dir);
+    ~ParamManager();
+
+    static const QList<ParamFile>& paramFiles();
+
+    // True if the file at path has the expected hash. It is only hashed if it's new or has changed
+    // since it was last checked.
+    static bool isVerified(const QString& path, const ParamFile& param);
+
+    // Downloads every one of files that isn't verified in dir yet
+    void download(const QList<ParamFile>& files,
+                  std::function<void(const QString& name, qint64 done, qint64 total, double bytesPerSec, int remaining)> progress,
+                  std::function<void(bool ok, const QString& error)> done);
+
+private:
+    struct Chunk {
+        qint64          next;           // Next byte expected from the server
+        qint64          end;            // One past the last byte
+        QByteArray      data;           // Received, but not written yet
+        QNetworkReply*  reply    = nullptr;
+        int             attempts = 0;
+    };
+
+    void startNext();
+    void startFile(QNetworkReply* head);
+    void fill();
+    void request(Chunk* chunk);
+    bool onData(Chunk* chunk);
+    void onFinished(Chunk* chunk);
+    bool flush();
+    void finishFile();
+    void restartWithoutRanges();
+    void fail(const QString& error);
+    void stopReplies();
+
+    static bool hashFile(QFile* file, qint64 length, crypto_hash_sha256_state* state);
+    static QByteArray toHex(crypto_hash_sha256_state* state);
+    static QString stampOf(const QFileInfo& info);
+    static void saveStamp(const QString& path, bool passed);
+
+    static const int    maxStreams   = 4;
+    static const qint64 chunkSize    = 4 * 1024 * 1024;
+    static const int    maxAttempts  = 3;
+
+    Logger*                 logger;
+    QString                 dir;
+    QNetworkAccessManager*  client;
+
+    QQueue<ParamFile>       queue;
+    std::function<void(const QString&, qint64, qint64, double, int)> progressCb;
+    std::function<void(bool, const QString&)>                        doneCb;
+
+    // The file being downloaded
+    ParamFile               current;
+    QFile*                  output      = nullptr;
+    QNetworkReply*          headReply   = nullptr;
+    crypto_hash_sha256_state hashState;
+    bool                    ranges      = false;    // Server takes Range requests
+    qint64                  total       = -1;       // -1 if the server didn't say
+    qint64                  written     = 0;
+    qint64                  nextOffset  = 0;        // Start of the next chunk to request
+    qint64                  fetched     = 0;        // Bytes received in this run, for the speed
+    bool                    resumed     = false;    // Carried on from an earlier .part file
+    QElapsedTimer           fileTime;
+    QList<Chunk*>           chunks;                 // In file order, the first one is being written
+};
+
+#endif // PARAMMANAGER_H
@@ -6,8 +6,13 @@
 #include <cstdlib>
 #include <ctime>
 #include <cmath>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include <QtGlobal>
+#include <QtEndian>
 
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 10, 0))
 #include <QRandomGenerator>
@@ -37,10 +42,13 @@
 #include <QPushButton>
 #include <QDateTime>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <QTableWidget>
 #include <QSettings>
 #include <QStyle>
 #include <QFile>
 #include <QTemporaryFile>
+#include <QSaveFile>
 #include <QErrorMessage>
 #include <QApplication>
 #include <QWindow>
@@ -61,6 +69,7 @@
 #include <QtNetwork/QNetworkAccessManager>
 #include <QtNetwork/QNetworkReply>
 #include <QtWebSockets/QtWebSockets>
+#include <QtConcurrent/QtConcurrent>
 #include <QJsonDocument>
 #include <QJsonArray>
 #include <QJsonObject>
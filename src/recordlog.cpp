@@ -0,0 +1,187 @@
+#include "recordlog.h"
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static const quint32 recordMagic = 0x53445231;    // "SDR1"
+static const int     headerSize  = 12;
+
+namespace {
+
+struct Crc32Table {
+    quint32 entries[256];
+
+    Crc32Table() {
+        for (quint32 i = 0; i < 256; i++) {
+            quint32 c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            entries[i] = c;
+        }
+    }
+};
+
+}
+
+// Standard CRC-32 (IEEE 802.3), same as zlib's crc32()
+static quint32 crc32(const char* data, int len) {
+    // Initialising a local static is thread safe, so logs can be appended from any thread
+    static const Crc32Table table;
+
+    quint32 crc = 0xFFFFFFFFu;
+    for (int i = 0; i < len; i++)
+        crc = table.entries[(crc ^ (uchar)data[i]) & 0xFF] ^ (crc >> 8);
+
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// QFile::flush() only hands the data to the OS. This waits until it's on disk, like
+// QSaveFile::commit() does.
+static bool syncToDisk(QFile& file) {
+#ifdef Q_OS_WIN
+    return FlushFileBuffers((HANDLE)_get_osfhandle(file.handle())) != 0;
+#else
+    return ::fsync(file.handle()) == 0;
+#endif
+}
+
+RecordLog::RecordLog(const QString& fileName) {
+    name = fileName;
+}
+
+QByteArray RecordLog::frame(const QByteArray& record) {
+    QByteArray framed(headerSize, '\0');
+    qToLittleEndian<quint32>(recordMagic,                            (uchar*)framed.data());
+    qToLittleEndian<quint32>((quint32)record.size(),                 (uchar*)framed.data() + 4);
+    qToLittleEndian<quint32>(crc32(record.constData(), record.size()), (uchar*)framed.data() + 8);
+    framed.append(record);
+
+    return framed;
+}
+
+/**
+ * Read all the valid records in the file. The file is memory mapped, and the only copies made
+ * are the returned payloads.
+ */
+QList<QByteArray> RecordLog::read() {
+    QList<QByteArray> result;
+    validSize = 0;
+    records   = 0;
+
+    QFile file(name);
+    if (!file.exists() || !file.open(QIODevice::ReadOnly))
+        return result;
+
+    qint64 size = file.size();
+    if (size == 0)
+        return result;
+
+    uchar* mapped = file.map(0, size);
+    QByteArray copy;
+    const uchar* data = mapped;
+    if (!mapped) {
+        copy = file.readAll();
+        data = (const uchar*)copy.constData();
+    }
+
+    qint64 pos = 0;
+    while (pos + headerSize <= size) {
+        quint32 magic = qFromLittleEndian<quint32>(data + pos);
+        quint32 len   = qFromLittleEndian<quint32>(data + pos + 4);
+        quint32 crc   = qFromLittleEndian<quint32>(data + pos + 8);
+
+        if (magic != recordMagic || pos + headerSize + (qint64)len > size)
+            break;
+
+        const char* payload = (const char*)data + pos + headerSize;
+        if (crc32(payload, len) != crc)
+            break;
+
+        result.push_back(QByteArray(payload, len));
+        pos += headerSize + len;
+    }
+
+    if (pos < size) {
+        qDebug() << "Ignoring" << (size - pos) << "bytes of damaged records at the end of" << name;
+    }
+
+    validSize = pos;
+    records   = result.size();
+
+    if (mapped)
+        file.unmap(mapped);
+    file.close();
+
+    return result;
+}
+
+bool RecordLog::append(const QByteArray& record) {
+    return append(QList<QByteArray>{ record });
+}
+
+// Append all the records with a single write. They're on disk when this returns true.
+bool RecordLog::append(const QList<QByteArray>& newRecords) {
+    if (newRecords.isEmpty())
+        return true;
+
+    if (validSize < 0)
+        read();
+
+    QFile file(name);
+    if (!file.open(QIODevice::ReadWrite))
+        return false;
+
+    // Drop a damaged tail left by a crash, so the new records are readable
+    if (file.size() != validSize)
+        file.resize(validSize);
+
+    QByteArray buf;
+    for (const auto& r : newRecords)
+        buf.append(frame(r));
+
+    file.seek(validSize);
+    bool ok = file.write(buf) == buf.size() && file.flush() && syncToDisk(file);
+    file.close();
+
+    if (ok) {
+        validSize += buf.size();
+        records   += newRecords.size();
+    } else {
+        // Don't know what made it to disk, so scan again next time
+        validSize = -1;
+    }
+
+    return ok;
+}
+
+bool RecordLog::rewrite(const QList<QByteArray>& newRecords) {
+    QSaveFile file(name);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    qint64 size = 0;
+    for (const auto& r : newRecords) {
+        auto framed = frame(r);
+        file.write(framed);
+        size += framed.size();
+    }
+
+    if (!file.commit()) {
+        validSize = -1;
+        return false;
+    }
+
+    validSize = size;
+    records   = newRecords.size();
+    return true;
+}
+
+void RecordLog::remove() {
+    QFile::remove(name);
+    validSize = -1;
+    records   = 0;
+}
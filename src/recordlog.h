@@ -0,0 +1,39 @@
+#ifndef RECORDLOG_H
+#define RECORDLOG_H
+
+#include "precompiled.h"
+
+/**
+ * An append-only file of records. Each record is written as
+ *     magic (4 bytes) | payload length (4 bytes) | crc32 of payload (4 bytes) | payload
+ * Reading stops at the first record that is truncated or fails its checksum, so a crash
+ * while appending loses only the record that was being written. The next append cuts the
+ * damaged tail off before writing. Appends are synced to disk before they return.
+ */
+class RecordLog {
+public:
+    explicit RecordLog(const QString& fileName);
+
+    const QString&    fileName() const   { return name; }
+    bool              exists() const     { return QFile::exists(name); }
+
+    // Number of valid records in the file, as of the last read() or append()
+    int               count() const      { return records; }
+
+    QList<QByteArray> read();
+    bool              append(const QByteArray& record);
+    bool              append(const QList<QByteArray>& records);
+
+    // Atomically replace the whole file with the given records. Used to compact the log.
+    bool              rewrite(const QList<QByteArray>& records);
+    void              remove();
+
+private:
+    static QByteArray frame(const QByteArray& record);
+
+    QString           name;
+    qint64            validSize = -1;   // -1 until the file has been scanned
+    int               records   = 0;
+};
+
+#endif // RECORDLOG_H
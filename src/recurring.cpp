@@ -12,9 +12,11 @@ void Recurring::showEditDialog(QWidget* parent, MainWindow* main, Tx tx) {
     Settings::saveRestore(&d);
 
     // Add all the from addresses
-    auto allBalances = main->getRPC()->getAllBalances();
-    for (QString addr : allBalances->keys()) {
-        ui.cmbFromAddress->addItem(addr, allBalances->value(addr));
+    auto state = main->getRPC()->getWalletState();
+    if (state) {
+        for (const auto& addr : state->getAddresses()) {
+            ui.cmbFromAddress->addItem(addr, state->getBalance(addr));
+        }
     }
     
     if (!tx.fromAddr.isEmpty()) {
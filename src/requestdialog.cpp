@@ -28,11 +28,12 @@ void RequestDialog::setupDialog(MainWindow* main, QDialog* d, Ui_RequestDialog*
     req->txtMemo->setLenDisplayLabel(req->lblMemoLen);
     req->lblAmount->setText(req->lblAmount->text() + Settings::getTokenName());
 
-    if (!main || !main->getRPC() || !main->getRPC()->getAllZAddresses() || !main->getRPC()->getAllBalances())
+    if (!main || !main->getRPC() || !main->getRPC()->getAllZAddresses() || !main->getRPC()->getWalletState())
         return;
 
+    auto state = main->getRPC()->getWalletState();
     for (auto addr : *main->getRPC()->getAllZAddresses()) {
-        auto bal = main->getRPC()->getAllBalances()->value(addr);
+        auto bal = state->getBalance(addr);
         if (Settings::getInstance()->isSaplingAddress(addr)) {
             req->cmbMyAddress->addItem(addr, bal);
         }
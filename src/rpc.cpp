@@ -4,7 +4,9 @@
 
 #include "addressbook.h"
 #include "settings.h"
+#include "rpcreader.h"
 #include "senttxstore.h"
+#include "txcache.h"
 #include "version.h"
 #include "websockets.h"
 
@@ -51,18 +53,28 @@ RPC::RPC(MainWindow* main) {
     // Start at every 10s. When an operation is pending, this will change to every second
     txTimer->start(Settings::updateSpeed);  
 
+    // Write the on-disk cache a little while after the last update, so a refresh that
+    // touches several models only writes it once.
+    cacheTimer = new QTimer(main);
+    cacheTimer->setSingleShot(true);
+    QObject::connect(cacheTimer, &QTimer::timeout, [=]() {
+        saveCache();
+    });
+
     usedAddresses = new QMap<QString, bool>();
+
+    // Show the cached wallet right away, while the connection is still being made
+    loadCache();
 }
 
 RPC::~RPC() {
     delete timer;
     delete txTimer;
+    delete cacheTimer;
 
     delete transactionsTableModel;
     delete balancesTableModel;
 
-    delete utxos;
-    delete allBalances;
     delete usedAddresses;
     delete zaddresses;
     delete taddresses;
@@ -85,6 +97,19 @@ void RPC::setConnection(Connection* c) {
     delete conn;
     this->conn = c;
 
+    // A new connection might be to a different wallet, so sync all the txs again. The received
+    // z-tx details from the cache are still good if it's the same wallet.
+    auto wallet  = TxCache::walletKey(*c->config);
+    auto details = zrecvDetails;
+    resetTxSync();
+    if (wallet == cacheWallet) {
+        zrecvDetails = details;
+    } else if (!cacheWallet.isEmpty()) {
+        // What's shown is some other wallet's cache
+        clearWallet();
+    }
+    cacheWallet = wallet;
+
     ui->statusBar->showMessage("Ready! Thank you for helping secure the Hush network by running a full node.");
 
     // See if we need to remove the reindex/rescan flags from the zcash.conf file
@@ -101,6 +126,78 @@ void RPC::setConnection(Connection* c) {
     refresh(true);
 }
 
+/**
+ * Fill the balances and transactions tables from the on-disk cache. This is only for display; the
+ * addresses and balances used for sending are left empty until hushd has been queried, and the
+ * first refresh replaces all of it.
+ */
+void RPC::loadCache() {
+    TxCacheData cache;
+    if (!TxCache::read(cache))
+        return;
+
+    qDebug() << "Loaded tx cache at height" << cache.height;
+    setTestnet(cache.testnet);
+
+    balancesTableModel->setNewData(std::make_shared<WalletState>(cache.utxos));
+
+    transactionsTableModel->setChainHeight(cache.height);
+    transactionsTableModel->addTData(cache.tTxs, cache.height);
+    transactionsTableModel->addZSentData(cache.zSentTxs, cache.height);
+    transactionsTableModel->addZRecvData(cache.zRecvTxs, cache.height);
+
+    // Received z-tx details don't change once they're deep enough, so keep using them
+    zrecvDetails = cache.zrecvDetails;
+    chainHeight  = cache.height;
+    cacheWallet  = cache.wallet;
+
+    balT     = cache.balT;
+    balZ     = cache.balZ;
+    balTotal = cache.balTotal;
+
+    ui->balSheilded   ->setText(Settings::getDisplayFormat(balZ));
+    ui->balTransparent->setText(Settings::getDisplayFormat(balT));
+    ui->balTotal      ->setText(Settings::getDisplayFormat(balTotal));
+}
+
+void RPC::setTestnet(bool testnet) {
+    if (testnet == Settings::getInstance()->isTestnet())
+        return;
+
+    Settings::getInstance()->setTestnet(testnet);
+
+    // The token name in the formatted amounts is HUSH or TUSH
+    transactionsTableModel->invalidateFormatting();
+}
+
+void RPC::saveCacheLater() {
+    cacheTimer->start(5 * 1000);
+}
+
+void RPC::saveCache() {
+    // Don't overwrite a good cache with the empty state we're in while disconnected
+    auto state = getWalletState();
+    if (conn == nullptr || state == nullptr || cacheWallet.isEmpty())
+        return;
+
+    TxCacheData cache;
+    cache.wallet   = cacheWallet;
+    cache.testnet  = Settings::getInstance()->isTestnet();
+    cache.height   = chainHeight;
+    cache.balT     = balT;
+    cache.balZ     = balZ;
+    cache.balTotal = balTotal;
+
+    cache.tTxs     = transactionsTableModel->getTData();
+    cache.zSentTxs = transactionsTableModel->getZSentData();
+    cache.zRecvTxs = transactionsTableModel->getZRecvData();
+    cache.zrecvDetails = zrecvDetails;
+
+    cache.utxos    = state->getAllUTXOs();
+
+    TxCache::write(cache);
+}
+
 QJsonValue RPC::makePayload(QString method, QString params) {
     QJsonObject payload = {
         {"jsonrpc", "1.0"},
@@ -131,7 +228,7 @@ void RPC::getZAddresses(const std::function<void(QJsonValue)>& cb) {
     conn->doRPCWithDefaultErrorHandling(makePayload(method), cb);
 }
 
-void RPC::getTransparentUnspent(const std::function<void(QJsonValue)>& cb) {
+void RPC::getTransparentUnspent(const std::function<void(const QByteArray&)>& cb) {
     QJsonObject payload = {
         {"jsonrpc", "1.0"},
         {"id", "someid"},
@@ -139,10 +236,10 @@ void RPC::getTransparentUnspent(const std::function<void(QJsonValue)>& cb) {
         {"params", QJsonArray {0}}             // Get UTXOs with 0 confirmations as well.
     };
 
-    conn->doRPCWithDefaultErrorHandling(payload, cb);
+    conn->doRPCRawWithDefaultErrorHandling(payload, cb);
 }
 
-void RPC::getZUnspent(const std::function<void(QJsonValue)>& cb) {
+void RPC::getZUnspent(const std::function<void(const QByteArray&)>& cb) {
     QJsonObject payload = {
         {"jsonrpc", "1.0"},
         {"id", "someid"},
@@ -150,7 +247,7 @@ void RPC::getZUnspent(const std::function<void(QJsonValue)>& cb) {
         {"params", QJsonArray {0}}             // Get UTXOs with 0 confirmations as well.
     };
 
-    conn->doRPCWithDefaultErrorHandling(payload, cb);
+    conn->doRPCRawWithDefaultErrorHandling(payload, cb);
 }
 
 void RPC::newZaddr(const std::function<void(QJsonValue)>& cb) {
@@ -241,9 +338,56 @@ void RPC::getBalance(const std::function<void(QJsonValue)>& cb) {
     conn->doRPCWithDefaultErrorHandling(payload, cb);
 }
 
-void RPC::getTransactions(const std::function<void(QJsonValue)>& cb) {
-    QString method = "listtransactions";
-    conn->doRPCWithDefaultErrorHandling(makePayload(method), cb);
+// Get the hash of the block at height in the current best chain
+void RPC::getBlockHash(int height, const std::function<void(QString)>& cb, const std::function<void(void)>& err) {
+    QJsonObject payload = {
+        {"jsonrpc", "1.0"},
+        {"id", "someid"},
+        {"method", "getblockhash"},
+        {"params", QJsonArray {height}}
+    };
+
+    conn->doRPC(payload, [=] (const QJsonValue& reply) {
+        cb(reply.toString());
+    }, [=] (QNetworkReply*, const QJsonValue&) {
+        err();
+    });
+}
+
+void RPC::getBlockHeight(const QString& hash, const std::function<void(int)>& cb, const std::function<void(void)>& err) {
+    QJsonObject payload = {
+        {"jsonrpc", "1.0"},
+        {"id", "someid"},
+        {"method", "getblockheader"},
+        {"params", QJsonArray {hash}}
+    };
+
+    conn->doRPC(payload, [=] (const QJsonValue& reply) {
+        cb(reply.toObject()["height"].toInt());
+    }, [=] (QNetworkReply*, const QJsonValue&) {
+        err();
+    });
+}
+
+// Get all wallet txs since the given block, or the full history if sinceBlock is empty. 
+void RPC::getTransactions(QString sinceBlock, const std::function<void(const QByteArray&)>& cb,
+                          const std::function<void(void)>& err) {
+    QJsonObject payload = {
+        {"jsonrpc", "1.0"},
+        {"id", "someid"},
+        {"method", "listsinceblock"},
+        // The returned "lastblock" will trail the tip by reorgSafetyDepth blocks
+        {"params", QJsonArray {sinceBlock, Settings::reorgSafetyDepth}}
+    };
+
+    conn->doRPCRaw(payload, cb, [=] (QNetworkReply* reply, const QJsonValue &parsed) {
+        if (!parsed.isUndefined() && !parsed["error"].toObject()["message"].isNull()) {
+            qDebug() << "listsinceblock failed:" << parsed["error"].toObject()["message"].toString();
+        } else {
+            qDebug() << "listsinceblock failed:" << reply->errorString();
+        }
+        err();
+    });
 }
 
 void RPC::sendZTransaction(QJsonValue params, const std::function<void(QJsonValue)>& cb,
@@ -397,16 +541,26 @@ void RPC::noConnection() {
     main->statusLabel->setToolTip("");
     main->ui->statusBar->showMessage(QObject::tr("No Connection"), 1000);
 
+    // Start over with a full sync when the connection comes back
+    resetTxSync();
+    clearWallet();
+}
+
+// Empty the balances, transactions and send tab
+void RPC::clearWallet() {
+    // UTXOs that are still being read belong to what's cleared here
+    unspentApplied = unspentSeq;
+    zrecvApplied   = zrecvSeq;
+    unconfirmedTxids.clear();
+
     // Clear balances table.
-    QMap<QString, double> emptyBalances;
-    QList<UnspentOutput>  emptyOutputs;
-    balancesTableModel->setNewData(&emptyBalances, &emptyOutputs);
+    balancesTableModel->setNewData(std::make_shared<WalletState>());
 
-    // Clear Transactions table.
+    // Clear Transactions table
     QList<TransactionItem> emptyTxs;
-    transactionsTableModel->addTData(emptyTxs);
-    transactionsTableModel->addZRecvData(emptyTxs);
-    transactionsTableModel->addZSentData(emptyTxs);
+    transactionsTableModel->addTData(emptyTxs, 0);
+    transactionsTableModel->addZRecvData(emptyTxs, 0);
+    transactionsTableModel->addZSentData(emptyTxs, 0);
 
     // Clear balances
     ui->balSheilded->setText("");
@@ -430,9 +584,13 @@ void RPC::refreshReceivedZTrans(QList<QString> zaddrs) {
     // We'll only refresh the received Z txs if settings allows us.
     if (!Settings::getInstance()->getSaveZtxs()) {
         QList<TransactionItem> emptylist;
-        transactionsTableModel->addZRecvData(emptylist);
+        transactionsTableModel->addZRecvData(emptylist, chainHeight);
         return;
     }
+
+    // Refreshes overlap, and the wallet can be cleared while one is running. Only the newest
+    // results are shown.
+    int seq = ++zrecvSeq;
         
     // This method is complicated because z_listreceivedbyaddress only returns the txid, and 
     // we have to make a follow up call to gettransaction to get details of that transaction. 
@@ -451,95 +609,208 @@ void RPC::refreshReceivedZTrans(QList<QString> zaddrs) {
 
             return payload;
         },          
-        [=] (QMap<QString, QJsonValue>* zaddrTxids) {
-            // Process all txids, removing duplicates. This can happen if the same address
-            // appears multiple times in a single tx's outputs.
-            QSet<QString> txids;
-            QMap<QString, QString> memos;
+        [=] (QMap<QString, QJsonValue>* zaddrTxidsPtr) {
+            // The replies are read on worker threads from here on, and freed once the last one is done
+            auto zaddrTxids = std::shared_ptr<QMap<QString, QJsonValue>>(zaddrTxidsPtr);
+
+            // Mark the addresses as used
             for (auto it = zaddrTxids->constBegin(); it != zaddrTxids->constEnd(); it++) {
-                auto zaddr = it.key();
-                for (const auto& i : it.value().toArray()) {
-                    // Mark the address as used
-                    usedAddresses->insert(zaddr, true);
-
-                    // Filter out change txs
-                    if (! i.toObject()["change"].toBool()) {
-                        auto txid = i.toObject()["txid"].toString();
-                        txids.insert(txid);    
-
-                        // Check for Memos
-                        QString memoBytes = i.toObject()["memo"].toString();
-                        if (!memoBytes.startsWith("f600"))  {
-                            QString memo(QByteArray::fromHex(
-                                            i.toObject()["memo"].toString().toUtf8()));
-                            if (!memo.trimmed().isEmpty())
-                                memos[zaddr + txid] = memo;
-                        }
-                    }
-                }                        
+                if (!it.value().toArray().isEmpty())
+                    usedAddresses->insert(it.key(), true);
             }
 
-            // 2. For all txids, go and get the details of that txid.
-            conn->doBatchRPC<QString>(txids.toList(),
-                [=] (QString txid) {
-                    QJsonObject payload = {
-                        {"jsonrpc", "1.0"},
-                        {"id",  "gettx"},
-                        {"method", "gettransaction"},
-                        {"params", QJsonArray {txid}}
-                    };
+            runInBackground<QList<QString>>([=] () { return receivedTxids(*zaddrTxids); },
+                                            [=] (QList<QString> txids) {
+                // 2. For all txids, go and get the details of that txid. Txs that we've already seen
+                // buried deeper than the reorg safety depth don't change anymore, so their details
+                // are taken from zrecvDetails instead of asking hushd again.
+                int height = chainHeight;
+                QList<QString> unknownTxids;
+                for (const auto& txid : txids) {
+                    if (!zrecvDetails.contains(txid)) {
+                        unknownTxids.push_back(txid);
+                        continue;
+                    }
 
-                    return payload;
-                },
-                [=] (QMap<QString, QJsonValue>* txidDetails) {
-                    QList<TransactionItem> txdata;
-
-                    // Combine them both together. For every zAddr's txid, get the amount, fee, confirmations and time
-                    for (auto it = zaddrTxids->constBegin(); it != zaddrTxids->constEnd(); it++) {                        
-                        for (const auto& i : it.value().toArray()) {
-                            // Filter out change txs
-                            if (i.toObject()["change"].toBool())
-                                continue;
-                            
-                            auto zaddr = it.key();
-                            auto txid  = i.toObject()["txid"].toString();
-
-                            // Lookup txid in the map
-                            auto txidInfo = txidDetails->value(txid);
+                    auto details = zrecvDetails.value(txid);
+                    if (details.height == 0 || height - details.height + 1 < Settings::reorgSafetyDepth)
+                        unknownTxids.push_back(txid);
+                }
+
+                auto fnUpdateZRecvData = [=] () {
+                    // The details are copied here, so the worker has a snapshot of its own
+                    auto details = zrecvDetails;
+                    int height = chainHeight;
+
+                    runInBackground<QList<TransactionItem>>([=] () { return buildZRecvData(*zaddrTxids, details, height); },
+                        [=] (QList<TransactionItem> txdata) {
+                            if (seq <= zrecvApplied)
+                                return;
+                            zrecvApplied = seq;
+
+                            transactionsTableModel->addZRecvData(txdata, height);
+                            notifyConfirmations(txdata);
+                            saveCacheLater();
+                        });
+                };
+
+                if (unknownTxids.isEmpty()) {
+                    fnUpdateZRecvData();
+                    return;
+                }
+
+                conn->doBatchRPC<QString>(unknownTxids,
+                    [=] (QString txid) {
+                        QJsonObject payload = {
+                            {"jsonrpc", "1.0"},
+                            {"id",  "gettx"},
+                            {"method", "gettransaction"},
+                            {"params", QJsonArray {txid}}
+                        };
+
+                        return payload;
+                    },
+                    [=] (QMap<QString, QJsonValue>* txidDetails) {
+                        // The details may be of a wallet that was cleared since
+                        if (seq <= zrecvApplied) {
+                            delete txidDetails;
+                            return;
+                        }
+
+                        for (auto it = txidDetails->constBegin(); it != txidDetails->constEnd(); it++) {
+                            auto txidInfo = it.value().toObject();
 
                             qint64 timestamp;
-                            if (!txidInfo.toObject()["time"].isUndefined()) {
-                                timestamp = txidInfo.toObject()["time"].toInt();
+                            if (!txidInfo["time"].isUndefined()) {
+                                timestamp = txidInfo["time"].toInt();
                             } else {
-                                timestamp = txidInfo.toObject()["blocktime"].toInt();
+                                timestamp = txidInfo["blocktime"].toInt();
                             }
-                            
-                            auto amount        = i.toObject()["amount"].toDouble();
-                            auto confirmations = (unsigned long)txidInfo["confirmations"].toInt();
 
-                            TransactionItem tx{ QString("receive"), timestamp, zaddr, txid, amount, 
-                                                confirmations, "", memos.value(zaddr + txid, "") };
-                            txdata.push_front(tx);
+                            int confirmations = txidInfo["confirmations"].toInt();
+                            zrecvDetails[it.key()] = ZTxDetails{ timestamp, confirmations > 0 ? height - confirmations + 1 : 0 };
                         }
-                    }
 
-                    transactionsTableModel->addZRecvData(txdata);
-
-                    // Cleanup both responses;
-                    delete zaddrTxids;
-                    delete txidDetails;
-                }
-            );
+                        fnUpdateZRecvData();
+                        delete txidDetails;
+                    }
+                );
+            });
         }
     );
 } 
 
+// All the txids of received notes that aren't change, without duplicates. The same tx can appear
+// more than once if it paid the same address in several outputs.
+QList<QString> RPC::receivedTxids(const QMap<QString, QJsonValue>& zaddrTxids) {
+    QSet<QString> txids;
+    for (auto it = zaddrTxids.constBegin(); it != zaddrTxids.constEnd(); it++) {
+        for (const auto& i : it.value().toArray()) {
+            if (!i.toObject()["change"].toBool())
+                txids.insert(i.toObject()["txid"].toString());
+        }
+    }
+
+    return txids.toList();
+}
+
+// Combine the received notes with the details of their txs. For every zAddr's txid, get the
+// amount, memo, confirmations and time.
+QList<TransactionItem> RPC::buildZRecvData(const QMap<QString, QJsonValue>& zaddrTxids,
+                                           const QHash<QString, ZTxDetails>& details, int height) {
+    QList<TransactionItem> txdata;
+
+    for (auto it = zaddrTxids.constBegin(); it != zaddrTxids.constEnd(); it++) {
+        for (const auto& i : it.value().toArray()) {
+            // Filter out change txs
+            if (i.toObject()["change"].toBool())
+                continue;
+
+            auto zaddr = it.key();
+            auto txid  = i.toObject()["txid"].toString();
+
+            // Check for Memos
+            QString memo;
+            QString memoBytes = i.toObject()["memo"].toString();
+            if (!memoBytes.startsWith("f600")) {
+                memo = QString(QByteArray::fromHex(memoBytes.toUtf8()));
+                if (memo.trimmed().isEmpty())
+                    memo = "";
+            }
+
+            // Lookup txid in the map
+            auto txDetails     = details.value(txid, ZTxDetails{ 0, 0 });
+            auto amount        = i.toObject()["amount"].toDouble();
+            auto confirmations = (unsigned long)(txDetails.height > 0 ? height - txDetails.height + 1 : 0);
+
+            TransactionItem tx{ QString("receive"), txDetails.datetime, zaddr, txid, amount,
+                                confirmations, "", memo };
+            txdata.push_front(tx);
+        }
+    }
+
+    return txdata;
+}
+
 /// This will refresh all the balance data from hushd
 void RPC::refresh(bool force) {
     if  (conn == nullptr) 
         return noConnection();
 
     getInfoThenRefresh(force);
+    refreshRpcMetrics();
+}
+
+/**
+ * Show the RPC statistics on the hushd tab, and once a minute dump them to rpcmetrics.json in the
+ * app data dir, so they can be looked at on a wallet host without the UI.
+ */
+void RPC::refreshRpcMetrics() {
+    if (conn == nullptr)
+        return;
+
+    const auto& metrics = conn->getMetrics();
+
+    if (ui->tabWidget->currentWidget() == ui->tab_5) {
+        auto table = main->rpcMetricsTable;
+        const auto& stats = metrics.getStats();
+        table->setRowCount(stats.size());
+
+        auto fnSet = [=] (int row, int col, const QString& text) {
+            auto item = table->item(row, col);
+            if (item == nullptr) {
+                item = new QTableWidgetItem();
+                if (col > 0)
+                    item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+                table->setItem(row, col, item);
+            }
+            item->setText(text);
+        };
+        auto fnMs = [] (qint64 usecs) { return QString::number(usecs / 1000.0, 'f', 1); };
+
+        int row = 0;
+        for (auto it = stats.constBegin(); it != stats.constEnd(); it++, row++) {
+            const auto& s = it.value();
+            fnSet(row, 0, it.key());
+            fnSet(row, 1, QString::number(s.count));
+            fnSet(row, 2, QString::number(s.errors));
+            fnSet(row, 3, QString::number(s.inFlight));
+            fnSet(row, 4, fnMs(s.percentile(0.50)));
+            fnSet(row, 5, fnMs(s.percentile(0.95)));
+            fnSet(row, 6, fnMs(s.percentile(0.99)));
+            fnSet(row, 7, QString::number(s.bytesIn / 1024) % " / " % QString::number(s.bytesOut / 1024));
+        }
+    }
+
+    if (!metricsDumpTimer.isValid() || metricsDumpTimer.elapsed() >= 60 * 1000) {
+        metricsDumpTimer.start();
+
+        auto dir = QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation));
+        if (!dir.exists())
+            QDir().mkpath(dir.absolutePath());
+
+        metrics.writeDumpFile(dir.filePath("rpcmetrics.json"));
+    }
 }
 
 
@@ -555,7 +826,7 @@ void RPC::getInfoThenRefresh(bool force) {
         prevCallSucceeded = true;
         // Testnet?
         if (!reply["testnet"].isNull()) {
-            Settings::getInstance()->setTestnet(reply["testnet"].toBool());
+            setTestnet(reply["testnet"].toBool());
         };
 
         // TODO: checkmark only when getinfo.synced == true!
@@ -594,7 +865,16 @@ void RPC::getInfoThenRefresh(bool force) {
 
         if ( force || (curBlock != lastBlock) ) {
             // Something changed, so refresh everything.
-            lastBlock = curBlock;
+            if (curBlock < lastBlock) {
+                // The chain got shorter, which means a reorg. Don't trust any of the synced txs.
+                resetTxSync();
+            }
+            if (curBlock != lastBlock)
+                AppDataServer::getInstance()->pushEvent("newBlock", QJsonObject{ {"height", curBlock} });
+
+            lastBlock   = curBlock;
+            chainHeight = curBlock;
+            transactionsTableModel->setChainHeight(curBlock);
 
             refreshBalances();        
             refreshAddresses(); // This calls refreshZSentTransactions() and refreshReceivedZTrans()
@@ -780,31 +1060,26 @@ void RPC::updateUI(bool anyUnconfirmed) {
     ui->unconfirmedWarning->setVisible(anyUnconfirmed);
 
     // Update balances model data, which will update the table too
-    balancesTableModel->setNewData(allBalances, utxos);
+    balancesTableModel->setNewData(getWalletState());
 
     // Update from address
     main->updateFromCombo();
 };
 
-// Function to process reply of the listunspent and z_listunspent API calls, used below.
-bool RPC::processUnspent(const QJsonValue& reply, QMap<QString, double>* balancesMap, QList<UnspentOutput>* newUtxos) {
-    bool anyUnconfirmed = false;
-    for (const auto& it : reply.toArray()) {
-        QString qsAddr = it.toObject()["address"].toString();
-        auto confirmations = it.toObject()["confirmations"].toInt();
-        if (confirmations == 0) {
-            anyUnconfirmed = true;
-        }
-
-        newUtxos->push_back(
-            UnspentOutput{ qsAddr, it.toObject()["txid"].toString(),
-                            Settings::getDecimalString(it.toObject()["amount"].toDouble()),
-                            (int)confirmations, it.toObject()["spendable"].toBool() });
+// Build the new wallet state from the replies of the listunspent and z_listunspent API calls.
+// If they couldn't be read, there's no state and the warning says why.
+UnspentReply RPC::processUnspent(const QByteArray& tReply, const QByteArray& zReply) {
+    UnspentReply read;
 
-        (*balancesMap)[qsAddr] = (*balancesMap)[qsAddr] + it.toObject()["amount"].toDouble();
+    QList<UnspentOutput> utxos;
+    if (!RpcReader::readUnspent(tReply, &utxos) || !RpcReader::readUnspent(zReply, &utxos)) {
+        read.warning = "Couldn't read the reply to listunspent/z_listunspent";
+        return read;
     }
-    return anyUnconfirmed;
-};
+
+    read.state = std::make_shared<WalletState>(utxos);
+    return read;
+}
 
 void RPC::refreshBalances() {    
     if  (conn == nullptr) 
@@ -812,10 +1087,18 @@ void RPC::refreshBalances() {
 
     // 1. Get the Balances
     getBalance([=] (QJsonValue reply) {
+        auto oldT = balT;
+        auto oldZ = balZ;
 
-        auto balT      = reply["transparent"].toString().toDouble();
-        auto balZ      = reply["private"].toString().toDouble();
-        auto balTotal  = reply["total"].toString().toDouble();
+        balT      = reply["transparent"].toString().toDouble();
+        balZ      = reply["private"].toString().toDouble();
+        balTotal  = reply["total"].toString().toDouble();
+
+        if (balT != oldT || balZ != oldZ) {
+            AppDataServer::getInstance()->pushEvent("balanceChanged", QJsonObject{
+                {"balance", balTotal}, {"tbalance", balT}, {"zbalance", balZ}
+            });
+        }
 
         AppDataModel::getInstance()->setBalances(balT, balZ);
 
@@ -832,63 +1115,171 @@ void RPC::refreshBalances() {
     });
 
     // 2. Get the UTXOs
-    // First, create a new UTXO list. It will be replacing the existing list when everything is processed.
-    auto newUtxos = new QList<UnspentOutput>();
-    auto newBalances = new QMap<QString, double>();
-
-    // Call the Transparent and Z unspent APIs serially and then, once they're done, update the UI
-    getTransparentUnspent([=] (QJsonValue reply) {
-        auto anyTUnconfirmed = processUnspent(reply, newBalances, newUtxos);
-
-        getZUnspent([=] (QJsonValue reply) {
-            auto anyZUnconfirmed = processUnspent(reply, newBalances, newUtxos);
-
-            // Swap out the balances and UTXOs
-            delete allBalances;
-            delete utxos;
+    // Call the Transparent and Z unspent APIs serially. Once they're both in, the new wallet state
+    // is built from them on a worker thread, and then swapped in and shown.
+    int seq = ++unspentSeq;
+    getTransparentUnspent([=] (const QByteArray& tReply) {
+        getZUnspent([=] (const QByteArray& zReply) {
+            runInBackground<UnspentReply>([=] () { return processUnspent(tReply, zReply); },
+                [=] (UnspentReply read) {
+                    // A newer refresh got here first, or the wallet was cleared since this one started
+                    if (seq <= unspentApplied)
+                        return;
+
+                    if (read.state == nullptr) {
+                        main->logger->write(Logger::Warning, read.warning);
+                        return;
+                    }
+                    unspentApplied = seq;
 
-            allBalances = newBalances;
-            utxos       = newUtxos;
+                    // Swap in the new balances and UTXOs
+                    auto newState = read.state;
+                    std::atomic_store(&walletState, newState);
 
-            updateUI(anyTUnconfirmed || anyZUnconfirmed);
+                    updateUI(newState->anyUnconfirmed());
+                    saveCacheLater();
 
-            main->balancesReady();
+                    main->balancesReady();
+                });
         });        
     });
 }
 
+void RPC::resetTxSync() {
+    txSyncCursor.clear();
+    txSyncCursorHeight = 0;
+    txSyncedHeight = 0;
+    txSyncEpoch++;
+    sentTxBlocksChecked = false;
+    zrecvDetails.clear();
+    pruneUnconfirmed();
+}
+
 void RPC::refreshTransactions() {    
     if  (conn == nullptr) 
         return noConnection();
 
-    getTransactions([=] (QJsonValue reply) {
-        QList<TransactionItem> txdata;
+    // The first sync gets the full history. After that, only the txs since the cursor are fetched 
+    // and patched into the model.
+    QString cursor = txSyncCursor;
+    int syncedHeight = txSyncedHeight;
+    int height = chainHeight;
+
+    if (cursor.isEmpty())
+        return syncTransactions(cursor, syncedHeight, height);
+
+    // The chain can be replaced by one of the same or a greater height, so the block at the cursor
+    // height is checked every time. If it's not the cursor anymore, synced rows may be orphaned.
+    auto resync = [=] () {
+        if (cursor != txSyncCursor)
+            return;
+
+        main->logger->write(Logger::Warning, "Block " + QString::number(txSyncCursorHeight) +
+                                             " was reorged, syncing all transactions again");
+        resetTxSync();
+        syncTransactions(QString(), 0, height);
+    };
 
-        for (const auto& it : reply.toArray()) {
-            double fee = 0;
-            if (!it.toObject()["fee"].isNull()) {
-                fee = it.toObject()["fee"].toDouble();
-            }
+    getBlockHash(txSyncCursorHeight, [=] (QString hash) {
+        if (hash != cursor) {
+            resync();
+        } else if (cursor == txSyncCursor) {
+            syncTransactions(cursor, syncedHeight, height);
+        }
+    }, resync);
+}
+
+void RPC::syncTransactions(QString cursor, int syncedHeight, int height) {
+    // A full sync has no cursor to tell it apart from the one after a reset, so that's counted
+    int epoch = txSyncEpoch;
+    getTransactions(cursor, [=] (const QByteArray& reply) {
+        // The reply is read on a worker thread, and only the finished list comes back here
+        runInBackground<TxSyncReply>([=] () {
+            TxSyncReply read;
+            read.ok = RpcReader::readSinceBlock(reply, &read.txs, &read.lastBlock);
+            return read;
+        }, [=] (TxSyncReply read) {
+            if (!read.ok)
+                return applyTxSyncReply(read, cursor, syncedHeight, height, epoch);
+
+            // A block may have come in since chainHeight was read, so where the new cursor is
+            // has to come from the chain itself
+            getBlockHeight(read.lastBlock, [=] (int lastBlockHeight) {
+                auto located = read;
+                located.lastBlockHeight = lastBlockHeight;
+                applyTxSyncReply(located, cursor, syncedHeight, height, epoch);
+            }, [=] () {
+                if (cursor == txSyncCursor)
+                    resetTxSync();
+            });
+        });
+    }, [=] () {
+        // The cursor might not be valid anymore, so do a full sync next time
+        if (cursor == txSyncCursor)
+            resetTxSync();
+    });
+}
+
+void RPC::applyTxSyncReply(const TxSyncReply& read, QString cursor, int syncedHeight, int height, int epoch) {
+    // If another refresh already moved the cursor (or it was reset), this reply is stale
+    if (epoch != txSyncEpoch || cursor != txSyncCursor || syncedHeight != txSyncedHeight)
+        return;
 
-            QString address = (it.toObject()["address"].isNull() ? "" : it.toObject()["address"].toString());
+    if (!read.ok) {
+        main->logger->write(Logger::Warning, "Couldn't read the reply to listsinceblock");
+        resetTxSync();
+        return;
+    }
+
+    // listsinceblock's lastblock is the block reorgSafetyDepth - 1 below the tip it listed up to.
+    // On a chain that's shorter than that, it's the genesis block.
+    int tip = read.lastBlockHeight > 0 ? read.lastBlockHeight + Settings::reorgSafetyDepth - 1 : height;
+
+    const auto& txdata = read.txs;
+    for (const auto& tx : txdata) {
+        if (!tx.address.isEmpty())
+            usedAddresses->insert(tx.address, true);
+    }
+
+    // Update model data, which updates the table view
+    if (cursor.isEmpty()) {
+        transactionsTableModel->addTData(txdata, tip);
+    } else {
+        transactionsTableModel->patchTData(txdata, tip);
+    }
+    notifyConfirmations(txdata);
+    pruneUnconfirmed();
+
+    txSyncCursor       = read.lastBlock;
+    txSyncCursorHeight = read.lastBlockHeight;
+    txSyncedHeight     = tip;
 
-            TransactionItem tx{
-                it.toObject()["category"].toString(),
-                (qint64)it.toObject()["time"].toInt(),
-                address,
-                it.toObject()["txid"].toString(),
-                it.toObject()["amount"].toDouble() + fee,
-                (unsigned long)it.toObject()["confirmations"].toInt(),
-                "", "" };
+    saveCacheLater();
+}
 
-            txdata.push_back(tx);
-            if (!address.isEmpty())
-                usedAddresses->insert(address, true);
+// Push a txConfirmed event for the txs that had no confirmations the last time they were seen, and
+// now have one. A tx can be in more than one row, but is only announced once.
+void RPC::notifyConfirmations(const QList<TransactionItem>& txs) {
+    for (const auto& tx : txs) {
+        if (tx.txid.isEmpty())
+            continue;
+
+        if (tx.confirmations == 0) {
+            unconfirmedTxids.insert(tx.txid);
+        } else if (unconfirmedTxids.remove(tx.txid)) {
+            AppDataServer::getInstance()->pushEvent("txConfirmed", QJsonObject{
+                {"txid", tx.txid}, {"confirmations", (qint64)tx.confirmations}
+            });
         }
+    }
+}
 
-        // Update model data, which updates the table view
-        transactionsTableModel->addTData(txdata);        
-    });
+// Forget the txs that aren't unconfirmed rows in the table anymore. patchTData drops the rows of
+// txs that left the mempool, so after every sync this catches them. They'd never be seen with a
+// confirmation, so they'd stay in the set for good. Txs that were confirmed were already announced
+// and removed by notifyConfirmations.
+void RPC::pruneUnconfirmed() {
+    unconfirmedTxids.intersect(transactionsTableModel->getUnconfirmedTxIds());
 }
 
 // Read sent Z transactions from the file.
@@ -896,19 +1287,47 @@ void RPC::refreshSentZTrans() {
     if  (conn == nullptr) 
         return noConnection();
 
-    auto sentZTxs = SentTxStore::readSentTxFile();
+    // After a reorg, or on a new connection, the recorded blocks are checked once before they're
+    // used. Txs whose block isn't in the chain anymore are looked up again.
+    if (!sentTxBlocksChecked) {
+        sentTxBlocksChecked = true;
+
+        auto blocks = SentTxStore::readConfirmations();
+        if (!blocks.isEmpty()) {
+            checkSentTxBlocks(blocks, [=] (const QList<QString>&, const QList<QString>& reorged) {
+                if (!reorged.isEmpty()) {
+                    main->logger->write(Logger::Warning, QString::number(reorged.size()) + " sent z-txs were reorged");
+                    SentTxStore::removeConfirmations(reorged);
+                }
+                refreshSentZTrans();
+            });
+            return;
+        }
+    }
+
+    int height = chainHeight;
+    auto sentZTxs = SentTxStore::readSentTxFile(height);
 
     // If there are no sent z txs, then empty the table. 
     // This happens when you clear history.
     if (sentZTxs.isEmpty()) {
-        transactionsTableModel->addZSentData(sentZTxs);
+        transactionsTableModel->addZSentData(sentZTxs, height);
         return;
     }
 
+    // Txs that already have their block recorded in the file got their confirmations computed from
+    // the current height. Only the rest need to be looked up. 
     QList<QString> txids;
 
     for (auto sentTx: sentZTxs) {
-        txids.push_back(sentTx.txid);
+        if (sentTx.confirmations == 0)
+            txids.push_back(sentTx.txid);
+    }
+
+    if (txids.isEmpty()) {
+        transactionsTableModel->addZSentData(sentZTxs, height);
+        saveCacheLater();
+        return;
     }
 
     // Look up all the txids to get the confirmation count for them. 
@@ -925,25 +1344,80 @@ void RPC::refreshSentZTrans() {
         },          
         [=] (QMap<QString, QJsonValue>* txidList) {
             auto newSentZTxs = sentZTxs;
+            QMap<QString, SentTxConfirmation> newlyConfirmed;
+
             // Update the original sent list with the confirmation count
-            // TODO: This whole thing is kinda inefficient. We should probably just update the file
-            // with the confirmed block number, so we don't have to keep calling gettransaction for the
-            // sent items.
             for (TransactionItem& sentTx: newSentZTxs) {
+                if (!txidList->contains(sentTx.txid))
+                    continue;
+
                 auto j = txidList->value(sentTx.txid);
                 if (j.isNull())
                     continue;
                 auto error = j["confirmations"].isNull();
-                if (!error)
-                    sentTx.confirmations = j["confirmations"].toInt();
+                if (error)
+                    continue;
+
+                sentTx.confirmations = j["confirmations"].toInt();
+
+                // Once the tx is deep enough, remember its block so it is never looked up again
+                if (height > 0 && sentTx.confirmations >= (unsigned long)Settings::reorgSafetyDepth) {
+                    newlyConfirmed[sentTx.txid] = SentTxConfirmation{ 
+                        height - (int)sentTx.confirmations + 1, j["blockhash"].toString() };
+                }
             }
+
+            // The height is worked out from the confirmations, so it's off by one if a block came
+            // in since chainHeight was read. Only blocks that getblockhash agrees with are kept.
+            checkSentTxBlocks(newlyConfirmed, [=] (const QList<QString>& inChain, const QList<QString>&) {
+                QMap<QString, SentTxConfirmation> verified;
+                for (const auto& txid : inChain)
+                    verified[txid] = newlyConfirmed[txid];
+                SentTxStore::addConfirmations(verified);
+            });
             
-            transactionsTableModel->addZSentData(newSentZTxs);
+            transactionsTableModel->addZSentData(newSentZTxs, height);
+            notifyConfirmations(newSentZTxs);
+            saveCacheLater();
             delete txidList;
         }
      );
 }
 
+/**
+ * Look up the hash of the block at each recorded height, and split the txids into those whose
+ * block is still in the best chain and those whose block was replaced. Txs that couldn't be looked
+ * up are in neither list.
+ */
+void RPC::checkSentTxBlocks(const QMap<QString, SentTxConfirmation>& blocks,
+                            const std::function<void(const QList<QString>&, const QList<QString>&)>& cb) {
+    conn->doBatchRPC<QString>(blocks.keys(),
+        [=] (QString txid) {
+            QJsonObject payload = {
+                {"jsonrpc", "1.0"},
+                {"id", "senttxblock"},
+                {"method", "getblockhash"},
+                {"params", QJsonArray {blocks[txid].height}}
+            };
+
+            return payload;
+        },
+        [=] (QMap<QString, QJsonValue>* hashes) {
+            QList<QString> inChain, reorged;
+            for (auto it = hashes->constBegin(); it != hashes->constEnd(); it++) {
+                if (it.value().toString() == blocks[it.key()].blockhash) {
+                    inChain.push_back(it.key());
+                } else {
+                    reorged.push_back(it.key());
+                }
+            }
+
+            delete hashes;
+            cb(inChain, reorged);
+        }
+    );
+}
+
 void RPC::addNewTxToWatch(const QString& newOpid, WatchedTx wtx) {    
     watchingOps.insert(newOpid, wtx);
 
@@ -1001,6 +1475,10 @@ void RPC::watchTxStatus() {
                     watchingOps.remove(id);
                     wtx.completed(id, txid);
 
+                    AppDataServer::getInstance()->pushEvent("opCompleted", QJsonObject{
+                        {"opid", id}, {"status", status}, {"txid", txid}
+                    });
+
                     qDebug() << "opid "<< id << " started at "<<QString::number((unsigned int)it.toObject()["creation_time"].toInt()) << " took " << QString::number((double)it.toObject()["execution_secs"].toDouble()) << " seconds";
 
                     // Refresh balances to show unconfirmed balances
@@ -1012,6 +1490,10 @@ void RPC::watchTxStatus() {
                     auto wtx = watchingOps[id];
                     watchingOps.remove(id);
                     wtx.error(id, errorMsg);
+
+                    AppDataServer::getInstance()->pushEvent("opCompleted", QJsonObject{
+                        {"opid", id}, {"status", status}, {"error", errorMsg}
+                    });
                 } 
             }
 
@@ -10,6 +10,7 @@
 #include "connection.h"
 
 class Turnstile;
+struct SentTxConfirmation;
 
 struct TransactionItem {
     QString         type;
@@ -20,6 +21,28 @@ struct TransactionItem {
     unsigned long   confirmations;
     QString         fromAddr;
     QString         memo;
+    int             vout            = -1;   // Output of a t-tx, -1 if there is none
+};
+
+// What we remember about a received z-tx, so that gettransaction only has to be called for it
+// until it is buried deeper than Settings::reorgSafetyDepth. 
+struct ZTxDetails {
+    qint64          datetime;
+    int             height;         // Block the tx was mined in, 0 if unconfirmed
+};
+
+// A listsinceblock reply, as read on a worker thread
+struct TxSyncReply {
+    bool                    ok = false;
+    QList<TransactionItem>  txs;
+    QString                 lastBlock;
+    int                     lastBlockHeight = 0;
+};
+
+// The listunspent and z_listunspent replies, as read on a worker thread
+struct UnspentReply {
+    WalletStatePtr          state;          // nullptr if the replies couldn't be read
+    QString                 warning;
 };
 
 struct WatchedTx {
@@ -45,6 +68,7 @@ public:
     
     void checkForUpdate(bool silent = true);
     void refreshPrice();
+    void refreshRpcMetrics();
     void getZboardTopics(std::function<void(QMap<QString, QString>)> cb);
 
     void executeTransaction(Tx tx, 
@@ -62,8 +86,8 @@ public:
     const TxTableModel*               getTransactionsModel() { return transactionsTableModel; }
     const QList<QString>*             getAllZAddresses()     { return zaddresses; }
     const QList<QString>*             getAllTAddresses()     { return taddresses; }
-    const QList<UnspentOutput>*       getUTXOs()             { return utxos; }
-    const QMap<QString, double>*      getAllBalances()       { return allBalances; }
+    // nullptr until the first balance refresh is done
+    WalletStatePtr                    getWalletState() const { return std::atomic_load(&walletState); }
     const QMap<QString, bool>*        getUsedAddresses()     { return usedAddresses; }
 
     void newZaddr(const std::function<void(QJsonValue)>& cb);
@@ -92,41 +116,106 @@ private:
     void refreshBalances();
 
     void refreshTransactions();    
+    void syncTransactions(QString cursor, int syncedHeight, int height);
+    void applyTxSyncReply(const TxSyncReply& read, QString cursor, int syncedHeight, int height, int epoch);
     void refreshSentZTrans();
+    void checkSentTxBlocks(const QMap<QString, SentTxConfirmation>& blocks,
+                           const std::function<void(const QList<QString>& inChain, const QList<QString>& reorged)>& cb);
     void refreshReceivedZTrans(QList<QString> zaddresses);
+    void notifyConfirmations(const QList<TransactionItem>& txs);
+    void pruneUnconfirmed();
+
+    // These run on a worker thread, so they must not touch the UI, the models or any other RPC state
+    static UnspentReply             processUnspent      (const QByteArray& tReply, const QByteArray& zReply);
+    static QList<QString>           receivedTxids       (const QMap<QString, QJsonValue>& zaddrTxids);
+    static QList<TransactionItem>   buildZRecvData      (const QMap<QString, QJsonValue>& zaddrTxids,
+                                                         const QHash<QString, ZTxDetails>& details, int height);
+
+    // Run work on the thread pool, and then done with its result back on the GUI thread
+    template<class T>
+    void runInBackground(const std::function<T()>& work, const std::function<void(T)>& done) {
+        auto watcher = new QFutureWatcher<T>(main);
+        QObject::connect(watcher, &QFutureWatcher<T>::finished, [=] () {
+            done(watcher->result());
+            watcher->deleteLater();
+        });
+        watcher->setFuture(QtConcurrent::run(work));
+    }
 
-    bool processUnspent     (const QJsonValue& reply, QMap<QString, double>* newBalances, QList<UnspentOutput>* newUtxos);
     void updateUI           (bool anyUnconfirmed);
 
     void getInfoThenRefresh(bool force);
+    void resetTxSync();
+
+    void clearWallet();
+    void setTestnet(bool testnet);
+
+    void loadCache();
+    void saveCacheLater();
+    void saveCache();
 
     void getBalance(const std::function<void(QJsonValue)>& cb);
     QJsonValue makePayload(QString method, QString params);
     QJsonValue makePayload(QString method);
 
-    void getTransparentUnspent  (const std::function<void(QJsonValue)>& cb);
-    void getZUnspent            (const std::function<void(QJsonValue)>& cb);
-    void getTransactions        (const std::function<void(QJsonValue)>& cb);
+    void getTransparentUnspent  (const std::function<void(const QByteArray&)>& cb);
+    void getZUnspent            (const std::function<void(const QByteArray&)>& cb);
+    void getBlockHash           (int height, const std::function<void(QString)>& cb,
+                                 const std::function<void(void)>& err);
+    void getBlockHeight         (const QString& hash, const std::function<void(int)>& cb,
+                                 const std::function<void(void)>& err);
+    void getTransactions        (QString sinceBlock, const std::function<void(const QByteArray&)>& cb,
+                                 const std::function<void(void)>& err);
     void getZAddresses          (const std::function<void(QJsonValue)>& cb);
     void getTAddresses          (const std::function<void(QJsonValue)>& cb);
 
     Connection*                 conn                        = nullptr;
     std::shared_ptr<QProcess>   ezcashd                     = nullptr;
 
-    QList<UnspentOutput>*       utxos                       = nullptr;
-    QMap<QString, double>*      allBalances                 = nullptr;
+    WalletStatePtr              walletState                 = nullptr;
+
+    // Every balance refresh gets the next number. The UTXOs are read on the thread pool, where they
+    // can finish in any order, so results older than the last one applied are dropped.
+    int                         unspentSeq                  = 0;
+    int                         unspentApplied              = 0;
+
+    // The same for the received z-txs, whose details are looked up and built in several steps
+    int                         zrecvSeq                    = 0;
+    int                         zrecvApplied                = 0;
+
     QMap<QString, bool>*        usedAddresses               = nullptr;
     QList<QString>*             zaddresses                  = nullptr;
     QList<QString>*             taddresses                  = nullptr;
     
     QMap<QString, WatchedTx>    watchingOps;
 
+    // Incremental tx sync state. txSyncCursor is the block hash that listsinceblock
+    // continues from, and is empty until the first full sync has completed. It is the block at
+    // txSyncCursorHeight, which is checked before every sync to catch reorgs.
+    int                         chainHeight                 = 0;
+    int                         txSyncedHeight              = 0;
+    QString                     txSyncCursor;
+    int                         txSyncCursorHeight          = 0;
+    int                         txSyncEpoch                 = 0;    // Bumped by resetTxSync()
+    QHash<QString, ZTxDetails>  zrecvDetails;
+
+    // Whether the blocks recorded for sent z-txs were checked against the chain since the last reset
+    bool                        sentTxBlocksChecked         = false;
+
+    // TxCache::walletKey of the wallet that's shown, and cached. Empty until there is one.
+    QString                     cacheWallet;
+
+    // Txs that had no confirmations when we last saw them, so the mobile apps can be told when they get one
+    QSet<QString>               unconfirmedTxids;
+
     TxTableModel*               transactionsTableModel      = nullptr;
     BalancesTableModel*         balancesTableModel          = nullptr;
 
     QTimer*                     timer;
     QTimer*                     txTimer;
     QTimer*                     priceTimer;
+    QTimer*                     cacheTimer;
+    QElapsedTimer               metricsDumpTimer;
 
     Ui::MainWindow*             ui;
     MainWindow*                 main;
@@ -134,6 +223,11 @@ private:
 
     // Current balance in the UI. If this number updates, then refresh the UI
     QString                     currentBalance;
+
+    // Last z_gettotalbalance, kept for the on-disk cache
+    double                      balT                        = 0;
+    double                      balZ                        = 0;
+    double                      balTotal                    = 0;
 };
 
 #endif // RPCCLIENT_H
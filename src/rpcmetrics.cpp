@@ -0,0 +1,100 @@
+#include "rpcmetrics.h"
+
+RpcMetrics::RpcMetrics() {
+    clock.start();
+}
+
+int RpcMetrics::bucketFor(qint64 usecs) {
+    if (usecs <= 1)
+        return 0;
+
+    int bucket = (int)(4 * std::log2((double)usecs));
+    return std::min(bucket, numBuckets - 1);
+}
+
+qint64 RpcMetrics::bucketUpperBound(int bucket) {
+    return (qint64)std::ceil(std::pow(2.0, (bucket + 1) / 4.0));
+}
+
+qint64 RpcMetrics::MethodStats::percentile(double p) const {
+    quint64 total = 0;
+    for (auto n : buckets)
+        total += n;
+
+    if (total == 0)
+        return 0;
+
+    quint64 target = (quint64)std::ceil(p * total);
+    quint64 seen   = 0;
+    for (int i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen >= target)
+            return bucketUpperBound(i);
+    }
+
+    return bucketUpperBound(buckets.size() - 1);
+}
+
+qint64 RpcMetrics::start(const QString& method, qint64 bytesOut) {
+    auto& s = stats[method];
+    if (s.buckets.isEmpty())
+        s.buckets.resize(numBuckets);
+
+    s.bytesOut += bytesOut;
+    s.inFlight++;
+    inFlight++;
+
+    return clock.nsecsElapsed();
+}
+
+void RpcMetrics::finish(const QString& method, qint64 token, qint64 bytesIn, bool error) {
+    auto& s = stats[method];
+    if (s.buckets.isEmpty())
+        s.buckets.resize(numBuckets);
+
+    s.count++;
+    s.bytesIn += bytesIn;
+    if (error)
+        s.errors++;
+    s.buckets[bucketFor((clock.nsecsElapsed() - token) / 1000)]++;
+
+    s.inFlight = std::max(0, s.inFlight - 1);
+    inFlight   = std::max(0, inFlight - 1);
+}
+
+void RpcMetrics::addErrors(const QString& method, int errors) {
+    stats[method].errors += errors;
+}
+
+QJsonObject RpcMetrics::toJson() const {
+    QJsonObject methods;
+    for (auto it = stats.constBegin(); it != stats.constEnd(); it++) {
+        const auto& s = it.value();
+        methods[it.key()] = QJsonObject {
+            {"count",       (qint64)s.count},
+            {"errors",      (qint64)s.errors},
+            {"bytesout",    s.bytesOut},
+            {"bytesin",     s.bytesIn},
+            {"inflight",    s.inFlight},
+            {"p50us",       s.percentile(0.50)},
+            {"p95us",       s.percentile(0.95)},
+            {"p99us",       s.percentile(0.99)}
+        };
+    }
+
+    return QJsonObject {
+        {"time",        QDateTime::currentMSecsSinceEpoch() / (qint64)1000},
+        {"uptimesecs",  clock.elapsed() / 1000},
+        {"inflight",    inFlight},
+        {"methods",     methods}
+    };
+}
+
+bool RpcMetrics::writeDumpFile(const QString& fileName) const {
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    file.write(QJsonDocument(toJson()).toJson());
+    return file.commit();
+}
@@ -0,0 +1,51 @@
+#ifndef RPCMETRICS_H
+#define RPCMETRICS_H
+
+#include "precompiled.h"
+
+/**
+ * Per-method counters and latency histograms for the RPC calls made to hushd. Latencies go into
+ * log scale buckets (4 per doubling, starting at 1us), so percentiles are accurate to about 19%
+ * with a fixed amount of memory per method. Only used from the GUI thread.
+ */
+class RpcMetrics {
+public:
+    struct MethodStats {
+        quint64             count     = 0;
+        quint64             errors    = 0;      // For batches, the failed calls in them
+        qint64              bytesOut  = 0;
+        qint64              bytesIn   = 0;
+        int                 inFlight  = 0;
+        QVector<quint32>    buckets;
+
+        // Latency in usecs that p (0..1) of the calls finished within
+        qint64              percentile(double p) const;
+    };
+
+    RpcMetrics();
+
+    // Call when a request is sent. Returns the token to pass to finish()
+    qint64  start(const QString& method, qint64 bytesOut);
+    void    finish(const QString& method, qint64 token, qint64 bytesIn, bool error);
+
+    // Calls that failed inside a reply that arrived fine, like the items of a batch
+    void    addErrors(const QString& method, int errors);
+
+    const QMap<QString, MethodStats>&   getStats() const    { return stats; }
+    int                                 getInFlight() const { return inFlight; }
+
+    QJsonObject toJson() const;
+    bool        writeDumpFile(const QString& fileName) const;
+
+private:
+    static const int    numBuckets = 128;
+
+    static int          bucketFor(qint64 usecs);
+    static qint64       bucketUpperBound(int bucket);
+
+    QElapsedTimer               clock;
+    QMap<QString, MethodStats>  stats;
+    int                         inFlight = 0;
+};
+
+#endif // RPCMETRICS_H
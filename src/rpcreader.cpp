@@ -0,0 +1,446 @@
+#include "rpcreader.h"
+#include "rpc.h"
+#include "walletstate.h"
+
+namespace {
+
+// A number as it was written in the reply: mantissa * 10^exponent. Amounts are kept exact this
+// way, until they're converted to zats or to a double.
+struct JsonNumber {
+    qint64  mantissa = 0;
+    int     exponent = 0;
+
+    double toDouble() const {
+        static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                         1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+        // Both sides are exact, so a single multiply or divide is correctly rounded
+        if (exponent >= 0 && exponent <= 22)
+            return mantissa * powers[exponent];
+        if (exponent < 0 && exponent >= -22)
+            return mantissa / powers[-exponent];
+        return mantissa * std::pow(10.0, exponent);
+    }
+
+    qint64 toInt() const {
+        qint64 v = mantissa;
+        for (int e = exponent; e > 0; e--)  v *= 10;
+        for (int e = exponent; e < 0; e++)  v /= 10;
+        return v;
+    }
+
+    // Rounded to the nearest zat, like WalletState::toZats
+    qint64 toZats() const {
+        int scale = exponent + 8;
+        if (scale >= 0) {
+            qint64 v = mantissa;
+            for (; scale > 0; scale--)  v *= 10;
+            return v;
+        }
+
+        qint64 div = 1;
+        for (; scale < 0 && div < 1000000000000000000LL; scale++)  div *= 10;
+        qint64 half = mantissa < 0 ? -div / 2 : div / 2;
+        return (mantissa + half) / div;
+    }
+};
+
+/**
+ * Pulls JSON values out of a buffer one at a time. Errors are sticky: once something unexpected
+ * is seen, every read fails and returns an empty value.
+ */
+class JsonScanner {
+public:
+    explicit JsonScanner(const QByteArray& data) :
+        p(data.constData()), end(data.constData() + data.size()) {}
+
+    bool ok() const { return !failed; }
+
+    char peek() {
+        skipWs();
+        return (p < end && !failed) ? *p : '\0';
+    }
+
+    // Steps into the object or array that starts here
+    bool enterObject() { return expect('{'); }
+    bool enterArray()  { return expect('['); }
+
+    /**
+     * Steps to the next member of the object that was entered, and reads its key. Returns false
+     * once the closing brace has been read (or on an error). The key points into the buffer, it's
+     * only valid until the next read.
+     */
+    bool nextMember(QLatin1String* key) {
+        if (!nextItem('}'))
+            return false;
+
+        // Keys are only compared against plain ASCII names, so they are never unescaped
+        if (!expect('"'))
+            return false;
+
+        const char* start = p;
+        while (p < end && *p != '"') {
+            if (*p == '\\')
+                p++;
+            p++;
+        }
+        if (p >= end)
+            return fail();
+
+        *key = QLatin1String(start, int(p - start));
+        p++;
+        return expect(':');
+    }
+
+    // Steps to the next element of the array that was entered. Returns false after the closing bracket.
+    bool nextElement() {
+        return nextItem(']');
+    }
+
+    QString readString() {
+        if (!expect('"'))
+            return QString();
+
+        // Fast path: no escapes, so the bytes can be decoded as they are
+        const char* start = p;
+        while (p < end && *p != '"' && *p != '\\')
+            p++;
+        if (p >= end) {
+            fail();
+            return QString();
+        }
+
+        QString s = QString::fromUtf8(start, int(p - start));
+        if (*p == '"') {
+            p++;
+            return s;
+        }
+
+        while (p < end && *p != '"') {
+            if (*p != '\\') {
+                start = p;
+                while (p < end && *p != '"' && *p != '\\')
+                    p++;
+                s.append(QString::fromUtf8(start, int(p - start)));
+                continue;
+            }
+
+            p++;
+            if (p >= end)
+                break;
+
+            char c = *p++;
+            switch (c) {
+            case '"':  s.append(QChar('"'));  break;
+            case '\\': s.append(QChar('\\')); break;
+            case '/':  s.append(QChar('/'));  break;
+            case 'b':  s.append(QChar('\b')); break;
+            case 'f':  s.append(QChar('\f')); break;
+            case 'n':  s.append(QChar('\n')); break;
+            case 'r':  s.append(QChar('\r')); break;
+            case 't':  s.append(QChar('\t')); break;
+            case 'u': {
+                // Surrogate pairs come as two escapes, which make the two QChars of the pair
+                if (end - p < 4) {
+                    fail();
+                    return QString();
+                }
+                bool hexOk;
+                ushort code = QByteArray::fromRawData(p, 4).toUShort(&hexOk, 16);
+                if (!hexOk) {
+                    fail();
+                    return QString();
+                }
+                s.append(QChar(code));
+                p += 4;
+                break;
+            }
+            default:
+                fail();
+                return QString();
+            }
+        }
+
+        if (p >= end) {
+            fail();
+            return QString();
+        }
+        p++;
+        return s;
+    }
+
+    // A string, or an empty string if the value is null
+    QString readStringOrNull() {
+        if (peek() == 'n') {
+            readLiteral("null");
+            return QString();
+        }
+        return readString();
+    }
+
+    JsonNumber readNumber() {
+        JsonNumber n;
+        skipWs();
+
+        bool negative = false;
+        if (p < end && *p == '-') {
+            negative = true;
+            p++;
+        }
+
+        // Digits past the 18th can't change a wallet amount, they're only counted
+        int digits = 0;
+        auto addDigit = [&] (char d, bool fraction) {
+            if (n.mantissa < 100000000000000000LL) {
+                n.mantissa = n.mantissa * 10 + (d - '0');
+                if (fraction)
+                    n.exponent--;
+            } else if (!fraction) {
+                n.exponent++;
+            }
+            digits++;
+        };
+
+        while (p < end && *p >= '0' && *p <= '9')
+            addDigit(*p++, false);
+        if (p < end && *p == '.') {
+            p++;
+            while (p < end && *p >= '0' && *p <= '9')
+                addDigit(*p++, true);
+        }
+        if (digits == 0) {
+            fail();
+            return JsonNumber();
+        }
+
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            p++;
+            bool negativeExp = false;
+            if (p < end && (*p == '+' || *p == '-'))
+                negativeExp = (*p++ == '-');
+
+            int exp = 0;
+            while (p < end && *p >= '0' && *p <= '9') {
+                if (exp < 10000)
+                    exp = exp * 10 + (*p - '0');
+                p++;
+            }
+            n.exponent += negativeExp ? -exp : exp;
+        }
+
+        if (negative)
+            n.mantissa = -n.mantissa;
+        return n;
+    }
+
+    // A number, or 0 if the value is null
+    JsonNumber readNumberOrNull() {
+        if (peek() == 'n') {
+            readLiteral("null");
+            return JsonNumber();
+        }
+        return readNumber();
+    }
+
+    bool readBool() {
+        if (peek() == 't')
+            return readLiteral("true");
+        readLiteral("false");
+        return false;
+    }
+
+    void skipValue() {
+        switch (peek()) {
+        case '{': {
+            enterObject();
+            QLatin1String key;
+            while (nextMember(&key))
+                skipValue();
+            break;
+        }
+        case '[':
+            enterArray();
+            while (nextElement())
+                skipValue();
+            break;
+        case '"':
+            p++;
+            while (p < end && *p != '"') {
+                if (*p == '\\')
+                    p++;
+                p++;
+            }
+            if (p >= end)
+                fail();
+            else
+                p++;
+            break;
+        case 't':  readLiteral("true");  break;
+        case 'f':  readLiteral("false"); break;
+        case 'n':  readLiteral("null");  break;
+        default:   readNumber();         break;
+        }
+    }
+
+private:
+    void skipWs() {
+        while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+            p++;
+    }
+
+    bool fail() {
+        failed = true;
+        p = end;
+        return false;
+    }
+
+    bool expect(char c) {
+        if (peek() != c)
+            return fail();
+        p++;
+        return true;
+    }
+
+    bool readLiteral(const char* literal) {
+        skipWs();
+        int len = int(qstrlen(literal));
+        if (end - p < len || qstrncmp(p, literal, uint(len)) != 0)
+            return fail();
+        p += len;
+        return true;
+    }
+
+    // Shared by objects and arrays: consumes the separator before the next item, or the closer
+    bool nextItem(char closer) {
+        char c = peek();
+        if (c == closer) {
+            p++;
+            return false;
+        }
+        if (c == ',') {
+            p++;
+            c = peek();
+        }
+        if (c == '\0' || c == closer)
+            return fail();
+        return true;
+    }
+
+    const char* p;
+    const char* end;
+    bool        failed = false;
+};
+
+// Steps into {"result": ..., "error": ..., "id": ...} and stops at the start of the result
+bool enterResult(JsonScanner& s) {
+    if (!s.enterObject())
+        return false;
+
+    QLatin1String key;
+    while (s.nextMember(&key)) {
+        if (key == QLatin1String("result"))
+            return s.peek() != 'n';     // A null result isn't what any caller expects
+        s.skipValue();
+    }
+    return false;
+}
+
+}
+
+bool RpcReader::readUnspent(const QByteArray& reply, QList<UnspentOutput>* utxos) {
+    JsonScanner s(reply);
+    if (!enterResult(s) || !s.enterArray())
+        return false;
+
+    QList<UnspentOutput> read;
+    QLatin1String key;
+    while (s.nextElement()) {
+        UnspentOutput utxo{ QString(), QString(), 0, 0, false };
+
+        if (!s.enterObject())
+            return false;
+        while (s.nextMember(&key)) {
+            if (key == QLatin1String("address"))
+                utxo.address = s.readString();
+            else if (key == QLatin1String("txid"))
+                utxo.txid = s.readString();
+            else if (key == QLatin1String("amount"))
+                utxo.amount = s.readNumber().toZats();
+            else if (key == QLatin1String("confirmations"))
+                utxo.confirmations = int(s.readNumber().toInt());
+            else if (key == QLatin1String("spendable"))
+                utxo.spendable = s.readBool();
+            else
+                s.skipValue();
+        }
+
+        read.push_back(utxo);
+    }
+
+    if (!s.ok())
+        return false;
+
+    utxos->append(read);
+    return true;
+}
+
+bool RpcReader::readSinceBlock(const QByteArray& reply, QList<TransactionItem>* txs, QString* lastBlock) {
+    JsonScanner s(reply);
+    if (!enterResult(s) || !s.enterObject())
+        return false;
+
+    QList<TransactionItem> read;
+    QString last;
+    QLatin1String key;
+    while (s.nextMember(&key)) {
+        if (key == QLatin1String("lastblock")) {
+            last = s.readString();
+            continue;
+        }
+        if (key != QLatin1String("transactions")) {
+            s.skipValue();
+            continue;
+        }
+
+        if (!s.enterArray())
+            return false;
+        while (s.nextElement()) {
+            TransactionItem tx{ "", 0, "", "", 0, 0, "", "" };
+            double fee = 0;
+            qint64 confirmations = 0;
+
+            if (!s.enterObject())
+                return false;
+            while (s.nextMember(&key)) {
+                if (key == QLatin1String("category"))
+                    tx.type = s.readString();
+                else if (key == QLatin1String("time"))
+                    tx.datetime = s.readNumber().toInt();
+                else if (key == QLatin1String("address"))
+                    tx.address = s.readStringOrNull();
+                else if (key == QLatin1String("txid"))
+                    tx.txid = s.readString();
+                else if (key == QLatin1String("amount"))
+                    tx.amount = s.readNumber().toDouble();
+                else if (key == QLatin1String("fee"))
+                    fee = s.readNumberOrNull().toDouble();
+                else if (key == QLatin1String("confirmations"))
+                    confirmations = s.readNumber().toInt();
+                else if (key == QLatin1String("vout"))
+                    tx.vout = int(s.readNumber().toInt());
+                else
+                    s.skipValue();
+            }
+
+            tx.amount += fee;
+            tx.confirmations = (unsigned long)(int)confirmations;
+            read.push_back(tx);
+        }
+    }
+
+    if (!s.ok())
+        return false;
+
+    txs->append(read);
+    *lastBlock = last;
+    return true;
+}
@@ -0,0 +1,26 @@
+#ifndef RPCREADER_H
+#define RPCREADER_H
+
+#include "precompiled.h"
+
+struct TransactionItem;
+struct UnspentOutput;
+
+/**
+ * Reads the replies of the calls that can return megabytes of data (listunspent, z_listunspent,
+ * listsinceblock) straight from the reply bytes, in a single pass and without building a
+ * QJsonDocument first. Only the fields that are used are turned into QStrings, everything else
+ * is skipped over.
+ *
+ * All methods return false, and leave the output untouched, if the reply isn't what was expected.
+ */
+class RpcReader {
+public:
+    // listunspent and z_listunspent
+    static bool readUnspent(const QByteArray& reply, QList<UnspentOutput>* utxos);
+
+    // listsinceblock
+    static bool readSinceBlock(const QByteArray& reply, QList<TransactionItem>* txs, QString* lastBlock);
+};
+
+#endif // RPCREADER_H
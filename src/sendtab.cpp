@@ -119,16 +119,13 @@ void MainWindow::editSchedule() {
 }
 
 void MainWindow::updateLabelsAutoComplete() {
-    QList<QString> list;
-    auto labels = AddressBook::getInstance()->getAllAddressLabels();
-    
-    std::transform(labels.begin(), labels.end(), std::back_inserter(list), [=] (auto la) -> QString {
-        return la.first % "/" % la.second;
-    });
-    
+    auto list = AddressBook::getInstance()->getCompletions();
+
     delete labelCompleter;
     labelCompleter = new QCompleter(list, this);
     labelCompleter->setCaseSensitivity(Qt::CaseInsensitive);
+    // The list is sorted, so the completer can binary search it for the typed prefix
+    labelCompleter->setModelSorting(QCompleter::CaseInsensitivelySortedModel);
 
     // Then, find all the address fields and update the completer.
     QRegularExpression re("Address[0-9]+", QRegularExpression::CaseInsensitiveOption);
@@ -138,14 +135,18 @@ void MainWindow::updateLabelsAutoComplete() {
 }
 
 void MainWindow::setDefaultPayFrom() {
+    auto state = rpc->getWalletState();
+    if (!state)
+        return;
+
     auto findMax = [=] (QString startsWith) {
-        double max_amt = 0;
+        qint64 max_amt = 0;
         int    idx     = -1;
 
         for (int i=0; i < ui->inputsCombo->count(); i++) {
             auto addr = ui->inputsCombo->itemText(i);
             if (addr.startsWith(startsWith)) {
-                auto amt = rpc->getAllBalances()->value(addr);
+                auto amt = state->getBalanceZats(addr);
                 if (max_amt < amt) {
                     max_amt = amt;
                     idx = i;
@@ -168,20 +169,18 @@ void MainWindow::setDefaultPayFrom() {
 };
 
 void MainWindow::updateFromCombo() {
-    if (!rpc || !rpc->getAllBalances())
+    if (!rpc || !rpc->getWalletState())
         return;
 
+    auto state = rpc->getWalletState();
     auto lastFromAddr = ui->inputsCombo->currentText();
 
     ui->inputsCombo->clear();
-    auto i = rpc->getAllBalances()->constBegin();
 
     // Add all the addresses into the inputs combo box
-    while (i != rpc->getAllBalances()->constEnd()) {
-        ui->inputsCombo->addItem(i.key(), i.value());
-        if (i.key() == lastFromAddr) ui->inputsCombo->setCurrentText(i.key());
-
-        ++i;
+    for (const auto& addr : state->getAddresses()) {
+        ui->inputsCombo->addItem(addr, state->getBalance(addr));
+        if (addr == lastFromAddr) ui->inputsCombo->setCurrentText(addr);
     }
 
     if (lastFromAddr.isEmpty()) {
@@ -194,7 +193,8 @@ void MainWindow::updateFromCombo() {
 
 void MainWindow::inputComboTextChanged(int index) {
     auto addr   = ui->inputsCombo->itemText(index);
-    auto bal    = rpc->getAllBalances()->value(addr);
+    auto state  = rpc->getWalletState();
+    auto bal    = state ? state->getBalance(addr) : 0;
     auto balFmt = Settings::getDisplayFormat(bal);
 
     ui->sendAddressBalance->setText(balFmt);
@@ -446,7 +446,8 @@ void MainWindow::removeExtraAddresses() {
 void MainWindow::maxAmountChecked(int checked) {
     if (checked == Qt::Checked) {
         ui->Amount1->setReadOnly(true);
-        if (rpc->getAllBalances() == nullptr) return;
+        auto state = rpc->getWalletState();
+        if (state == nullptr) return;
            
         // Calculate maximum amount
         double sumAllAmounts = 0.0;
@@ -468,10 +469,11 @@ void MainWindow::maxAmountChecked(int checked) {
 
         auto addr = ui->inputsCombo->currentText();
 
-        auto maxamount  = rpc->getAllBalances()->value(addr) - sumAllAmounts;
+        // Subtract in zatoshis, so the max amount is exact
+        auto maxamount  = state->getBalanceZats(addr) - WalletState::toZats(sumAllAmounts);
         maxamount       = (maxamount < 0) ? 0 : maxamount;
             
-        ui->Amount1->setText(Settings::getDecimalString(maxamount));
+        ui->Amount1->setText(Settings::getDecimalString(WalletState::fromZats(maxamount)));
     } else if (checked == Qt::Unchecked) {
         // Just remove the readonly part, don't change the content
         ui->Amount1->setReadOnly(false);
@@ -527,7 +529,9 @@ Tx MainWindow::createTxFromSendPage() {
         });
 
         if (saplingAddr != rpc->getAllZAddresses()->end()) {
-            double change = rpc->getAllBalances()->value(tx.fromAddr) - totalAmt - tx.fee;
+            auto state = rpc->getWalletState();
+            auto changeZats = (state ? state->getBalanceZats(tx.fromAddr) : 0) - WalletState::toZats(totalAmt) - WalletState::toZats(tx.fee);
+            double change = WalletState::fromZats(changeZats);
 
             if (Settings::getDecimalString(change) != "0") {
                 QString changeMemo = tr("Change from ") + tx.fromAddr;
@@ -671,10 +675,12 @@ bool MainWindow::confirmTx(Tx tx) {
 
     // And FromAddress in the confirm dialog 
     confirm.sendFrom->setText(fnSplitAddressForWrap(tx.fromAddr));
+    auto state = rpc->getWalletState();
+    auto fromBalance = state ? state->getBalanceZats(tx.fromAddr) : 0;
     QString tooltip = tr("Current balance      : ") +
-        Settings::getZECUSDDisplayFormat(rpc->getAllBalances()->value(tx.fromAddr));
+        Settings::getZECUSDDisplayFormat(WalletState::fromZats(fromBalance));
     tooltip += "\n" + tr("Balance after this Tx: ") +
-        Settings::getZECUSDDisplayFormat(rpc->getAllBalances()->value(tx.fromAddr) - totalSpending);
+        Settings::getZECUSDDisplayFormat(WalletState::fromZats(fromBalance - WalletState::toZats(totalSpending)));
     confirm.sendFrom->setToolTip(tooltip);
 
     // Show the dialog and submit it if the user confirms
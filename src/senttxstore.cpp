@@ -1,10 +1,16 @@
 #include "senttxstore.h"
+#include "recordlog.h"
 #include "settings.h"
 
-/// Get the location of the app data file to be written. 
-QString SentTxStore::writeableFile() {
-    auto filename = QStringLiteral("senttxstore.dat");
+// The sent txs are kept in an append-only RecordLog. Every record is a compact JSON object:
+// either a "sent" tx, or a "confirm" record that adds the block of an earlier tx. The whole log
+// is read once, and then kept in memory, indexed by txid.
+RecordLog*              SentTxStore::journal = nullptr;
+QList<QJsonObject>      SentTxStore::sentTxs;
+QHash<QString, int>     SentTxStore::txidIndex;
 
+/// Get the location of the app data file to be written.
+QString SentTxStore::writeableFile(const QString& filename) {
     auto dir = QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation));
     if (!dir.exists())
         QDir().mkpath(dir.absolutePath());
@@ -16,34 +22,118 @@ QString SentTxStore::writeableFile() {
     }
 }
 
-// delete the sent history. 
+// delete the sent history.
 void SentTxStore::deleteHistory() {
-    QFile data(writeableFile());
+    QFile data(writeableFile(QStringLiteral("senttxstore.dat")));
     data.remove();
     data.close();
+
+    // The JSON file from before the journal, kept around after it was migrated
+    QFile(writeableFile(QStringLiteral("senttxstore.dat.migrated"))).remove();
+
+    openJournal();
+    journal->remove();
+    sentTxs.clear();
+    txidIndex.clear();
 }
 
-QList<TransactionItem> SentTxStore::readSentTxFile() {
-    QFile data(writeableFile());
-    if (!data.exists()) {
-        return QList<TransactionItem>();
+/**
+ * Make sure the journal for the current network is open and loaded into memory. If there's no
+ * journal yet but there is an old JSON senttxstore.dat, it is migrated into the journal once.
+ */
+void SentTxStore::openJournal() {
+    auto journalFile = writeableFile(QStringLiteral("senttxstore.log"));
+    if (journal != nullptr && journal->fileName() == journalFile)
+        return;
+
+    delete journal;
+    journal = new RecordLog(journalFile);
+    sentTxs.clear();
+    txidIndex.clear();
+
+    if (!journal->exists()) {
+        migrateJsonFile();
+        return;
+    }
+
+    for (const auto& record : journal->read()) {
+        applyRecord(QJsonDocument::fromJson(record).object());
     }
-    
-    QJsonDocument jsonDoc;
-    
-    data.open(QFile::ReadOnly);    
-    jsonDoc = QJsonDocument::fromJson(data.readAll());
+}
+
+void SentTxStore::migrateJsonFile() {
+    QFile data(writeableFile(QStringLiteral("senttxstore.dat")));
+    if (!data.exists() || !data.open(QFile::ReadOnly))
+        return;
+
+    QJsonDocument jsonDoc = QJsonDocument::fromJson(data.readAll());
     data.close();
 
+    QList<QByteArray> records;
+    for (auto i : jsonDoc.array()) {
+        auto txItem = i.toObject();
+        txItem["type"] = "sent";
+
+        applyRecord(txItem);
+        records.push_back(QJsonDocument(txItem).toJson(QJsonDocument::Compact));
+    }
+
+    // Keep the old file around under a new name, in case something went wrong
+    if (journal->rewrite(records)) {
+        qDebug() << "Migrated" << records.size() << "sent txs to" << journal->fileName();
+        data.rename(data.fileName() + ".migrated");
+    }
+}
+
+void SentTxStore::applyRecord(const QJsonObject& record) {
+    auto txid = record["txid"].toString();
+
+    if (record["type"].toString() == "confirm") {
+        if (!txidIndex.contains(txid))
+            return;
+
+        auto& txItem = sentTxs[txidIndex[txid]];
+        txItem["confirmedheight"] = record["confirmedheight"];
+        txItem["confirmedhash"]   = record["confirmedhash"];
+    } else {
+        txidIndex[txid] = sentTxs.size();
+        sentTxs.push_back(record);
+    }
+}
+
+/**
+ * Rewrite the journal with one record per tx, once the confirm records have made it much
+ * longer than it needs to be.
+ */
+void SentTxStore::compactIfNeeded() {
+    if (journal->count() < 2 * sentTxs.size() + 64)
+        return;
+
+    QList<QByteArray> records;
+    for (const auto& txItem : sentTxs) {
+        records.push_back(QJsonDocument(txItem).toJson(QJsonDocument::Compact));
+    }
+
+    qDebug() << "Compacting" << journal->fileName() << "from" << journal->count() << "to" << records.size() << "records";
+    journal->rewrite(records);
+}
+
+QList<TransactionItem> SentTxStore::readSentTxFile(int chainHeight) {
+    openJournal();
+
     QList<TransactionItem> items;
 
-    for (auto i : jsonDoc.array()) {
-        auto sentTx = i.toObject();
-        TransactionItem t{"send", (qint64)sentTx["datetime"].toVariant().toLongLong(), 
-                          sentTx["address"].toString(), 
-                          sentTx["txid"].toString(), 
-                          sentTx["amount"].toDouble() + sentTx["fee"].toDouble(), 
-                          0, sentTx["from"].toString(), ""};
+    for (const auto& sentTx : sentTxs) {
+        unsigned long confirmations = 0;
+        int confirmedHeight = sentTx["confirmedheight"].toInt();
+        if (confirmedHeight > 0 && chainHeight >= confirmedHeight)
+            confirmations = chainHeight - confirmedHeight + 1;
+
+        TransactionItem t{"send", (qint64)sentTx["datetime"].toVariant().toLongLong(),
+                          sentTx["address"].toString(),
+                          sentTx["txid"].toString(),
+                          sentTx["amount"].toDouble() + sentTx["fee"].toDouble(),
+                          confirmations, sentTx["from"].toString(), ""};
         items.push_back(t);
     }
 
@@ -55,28 +145,12 @@ void SentTxStore::addToSentTx(Tx tx, QString txid) {
     if (!Settings::getInstance()->getSaveZtxs())
         return;
 
-    // Also, only store outgoing txs where the from address is a z-Addr. Else, regular zcashd 
+    // Also, only store outgoing txs where the from address is a z-Addr. Else, regular zcashd
     // stores it just fine
-    if (!tx.fromAddr.startsWith("z")) 
+    if (!tx.fromAddr.startsWith("z"))
         return;
 
-    QFile data(writeableFile());
-    QJsonDocument jsonDoc;
-
-    // If data doesn't exist, then create a blank one
-    if (!data.exists()) {
-        QJsonArray a;
-        jsonDoc.setArray(a);
-
-        QFile newFile(writeableFile());
-        newFile.open(QFile::WriteOnly);
-        newFile.write(jsonDoc.toJson());
-        newFile.close();
-    } else {
-        data.open(QFile::ReadOnly);    
-        jsonDoc = QJsonDocument().fromJson(data.readAll());
-        data.close();
-    }
+    openJournal();
 
     // Calculate total amount in this tx
     double totalAmount = 0;
@@ -94,7 +168,6 @@ void SentTxStore::addToSentTx(Tx tx, QString txid) {
         }
     }
 
-    auto list = jsonDoc.array();
     QJsonObject txItem;
     txItem["type"]      = "sent";
     txItem["from"]      = tx.fromAddr;
@@ -105,13 +178,61 @@ void SentTxStore::addToSentTx(Tx tx, QString txid) {
     txItem["fee"]       = -tx.fee;
     // TODO: store all outgoing memos
     txItem["memo"]      = tx.toAddrs[0].txtMemo;
-    list.append(txItem);
 
-    jsonDoc.setArray(list);
+    if (journal->append(QJsonDocument(txItem).toJson(QJsonDocument::Compact))) {
+        applyRecord(txItem);
+    }
+}
+
+// Record the block that each of the given txs was mined in, so we don't have to ask hushd for
+// their confirmations again.
+void SentTxStore::addConfirmations(const QMap<QString, SentTxConfirmation>& confirmed) {
+    if (confirmed.isEmpty())
+        return;
+
+    openJournal();
+
+    QList<QJsonObject> confirmRecords;
+    QList<QByteArray> records;
+    for (auto it = confirmed.constBegin(); it != confirmed.constEnd(); it++) {
+        if (!txidIndex.contains(it.key()))
+            continue;
+
+        QJsonObject record;
+        record["type"]            = "confirm";
+        record["txid"]            = it.key();
+        record["confirmedheight"] = it.value().height;
+        record["confirmedhash"]   = it.value().blockhash;
+
+        confirmRecords.push_back(record);
+        records.push_back(QJsonDocument(record).toJson(QJsonDocument::Compact));
+    }
+
+    if (journal->append(records)) {
+        for (const auto& record : confirmRecords) {
+            applyRecord(record);
+        }
+        compactIfNeeded();
+    }
+}
+
+QMap<QString, SentTxConfirmation> SentTxStore::readConfirmations() {
+    openJournal();
+
+    QMap<QString, SentTxConfirmation> confirmed;
+    for (const auto& sentTx : sentTxs) {
+        int height = sentTx["confirmedheight"].toInt();
+        if (height > 0)
+            confirmed[sentTx["txid"].toString()] = SentTxConfirmation{ height, sentTx["confirmedhash"].toString() };
+    }
+    return confirmed;
+}
+
+// A confirm record without a block undoes the earlier one, so the tx is looked up again
+void SentTxStore::removeConfirmations(const QList<QString>& txids) {
+    QMap<QString, SentTxConfirmation> removed;
+    for (const auto& txid : txids)
+        removed[txid] = SentTxConfirmation{ 0, QString() };
 
-    QFile writer(writeableFile());
-    if (writer.open(QFile::WriteOnly | QFile::Truncate)) {
-        writer.write(jsonDoc.toJson());
-    } 
-    writer.close();
+    addConfirmations(removed);
 }
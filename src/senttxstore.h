@@ -5,16 +5,39 @@
 #include "mainwindow.h"
 #include "rpc.h"
 
+class RecordLog;
+
+// The block a sent tx was mined in. Only recorded once the tx is Settings::reorgSafetyDepth deep.
+struct SentTxConfirmation {
+    int     height;
+    QString blockhash;
+};
+
 class SentTxStore {
 public:
     static void deleteHistory();
 
-    static QList<TransactionItem> readSentTxFile();
+    // If chainHeight is given, the confirmations of txs with a recorded block are computed from it.
+    // All other txs are returned with 0 confirmations.
+    static QList<TransactionItem> readSentTxFile(int chainHeight = 0);
     static void                   addToSentTx(Tx tx, QString txid);
+    static void                   addConfirmations(const QMap<QString, SentTxConfirmation>& confirmed);
+
+    // The recorded block of every tx that has one, and forgetting it again after a reorg
+    static QMap<QString, SentTxConfirmation> readConfirmations();
+    static void                   removeConfirmations(const QList<QString>& txids);
 
 private:
-    static QString writeableFile();
-    
+    static QString writeableFile(const QString& filename);
+
+    static void    openJournal();
+    static void    migrateJsonFile();
+    static void    applyRecord(const QJsonObject& record);
+    static void    compactIfNeeded();
+
+    static RecordLog*           journal;
+    static QList<QJsonObject>   sentTxs;
+    static QHash<QString, int>  txidIndex;
 };
 
 #endif // SENTTXSTORE_H
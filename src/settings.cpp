@@ -24,6 +24,41 @@ void Settings::setCheckForUpdates(bool allow) {
      QSettings().setValue("options/allowcheckupdates", allow);
 }
 
+int Settings::getRPCBatchSize() {
+    // Number of calls packed into a single JSON-RPC batch array. 1 disables batching.
+    return QSettings().value("options/rpcbatchsize", 100).toInt();
+}
+
+void Settings::setRPCBatchSize(int size) {
+    QSettings().setValue("options/rpcbatchsize", size);
+}
+
+int Settings::getRPCMaxInFlight() {
+    // Number of HTTP requests that may be waiting on hushd at the same time
+    return QSettings().value("options/rpcmaxinflight", 8).toInt();
+}
+
+void Settings::setRPCMaxInFlight(int max) {
+    QSettings().setValue("options/rpcmaxinflight", max);
+}
+
+int Settings::getRPCClients() {
+    // Each client keeps up to 6 keep-alive connections to hushd
+    return QSettings().value("options/rpcclients", 2).toInt();
+}
+
+void Settings::setRPCClients(int clients) {
+    QSettings().setValue("options/rpcclients", clients);
+}
+
+bool Settings::getRPCPipelining() {
+    return QSettings().value("options/rpcpipelining", false).toBool();
+}
+
+void Settings::setRPCPipelining(bool allow) {
+    QSettings().setValue("options/rpcpipelining", allow);
+}
+
 bool Settings::getAllowFetchPrices() {
     return QSettings().value("options/allowfetchprices", true).toBool();
 }
@@ -80,6 +80,18 @@ public:
     bool    getCheckForUpdates();
     void    setCheckForUpdates(bool allow);
 
+    int     getRPCBatchSize();
+    void    setRPCBatchSize(int size);
+
+    int     getRPCMaxInFlight();
+    void    setRPCMaxInFlight(int max);
+
+    int     getRPCClients();
+    void    setRPCClients(int clients);
+
+    bool    getRPCPipelining();
+    void    setRPCPipelining(bool allow);
+
     bool    isSaplingActive();
 
     QString get_theme_name();
@@ -132,6 +144,7 @@ public:
     static QString getZboardAddr();
 
     static int     getMaxMobileAppTxns() { return 30; }
+    static int     getMaxMobileAppPage() { return 500; }
 
     static bool    isValidAddress(QString addr);
 
@@ -145,6 +158,10 @@ public:
     static const int     quickUpdateSpeed    = 3  * 1000;        // 3 sec
     static const int     priceRefreshSpeed   = 15 * 60 * 1000;   // 15 mins
 
+    // Txs with fewer confirmations than this are re-fetched from hushd on every block,
+    // deeper ones are assumed safe from reorgs.
+    static const int     reorgSafetyDepth    = 10;
+
 private:
     // This class can only be accessed through Settings::getInstance()
     Settings() = default;
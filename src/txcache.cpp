@@ -0,0 +1,150 @@
+#include "txcache.h"
+#include "connection.h"
+#include "settings.h"
+
+// Bump this if the format changes. Caches with any other version are ignored.
+static const QString cacheVersion = QStringLiteral("v3");
+
+static QDataStream& operator<<(QDataStream& out, const TransactionItem& tx) {
+    return out << tx.type << tx.datetime << tx.address << tx.txid << tx.amount
+               << (quint64)tx.confirmations << tx.fromAddr << tx.memo << (qint32)tx.vout;
+}
+
+static QDataStream& operator>>(QDataStream& in, TransactionItem& tx) {
+    quint64 confirmations;
+    qint32  vout;
+    in >> tx.type >> tx.datetime >> tx.address >> tx.txid >> tx.amount
+       >> confirmations >> tx.fromAddr >> tx.memo >> vout;
+    tx.confirmations = confirmations;
+    tx.vout          = vout;
+    return in;
+}
+
+static QDataStream& operator<<(QDataStream& out, const UnspentOutput& utxo) {
+    return out << utxo.address << utxo.txid << utxo.amount << utxo.confirmations << utxo.spendable;
+}
+
+static QDataStream& operator>>(QDataStream& in, UnspentOutput& utxo) {
+    return in >> utxo.address >> utxo.txid >> utxo.amount >> utxo.confirmations >> utxo.spendable;
+}
+
+static QDataStream& operator<<(QDataStream& out, const ZTxDetails& details) {
+    return out << details.datetime << details.height;
+}
+
+static QDataStream& operator>>(QDataStream& in, ZTxDetails& details) {
+    return in >> details.datetime >> details.height;
+}
+
+/// Get the location of the cache file. The cache is per network, like senttxstore.dat, and per wallet
+QString TxCache::writeableFile(bool testnet, const QString& wallet) {
+    QString filename = QStringLiteral("txcache-") % wallet % QStringLiteral(".dat");
+
+    auto dir = QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation));
+    if (!dir.exists())
+        QDir().mkpath(dir.absolutePath());
+
+    if (testnet) {
+        return dir.filePath("testnet-" % filename);
+    } else {
+        return dir.filePath(filename);
+    }
+}
+
+QString TxCache::walletKey(const ConnectionConfig& config) {
+    // The datadir tells wallets on the same machine apart. Without one, it's whatever hushd is at
+    // the host and port.
+    QString id = QStringLiteral("HUSH3|") % QDir::cleanPath(config.zcashDir) % "|" % config.host % ":" % config.port;
+    QByteArray utf8 = id.toUtf8();
+
+    unsigned char hash[crypto_hash_sha256_BYTES];
+    crypto_hash_sha256(hash, reinterpret_cast<const unsigned char*>(utf8.constData()), (unsigned long long)utf8.size());
+
+    return QByteArray(reinterpret_cast<const char*>(hash), 8).toHex();
+}
+
+void TxCache::deleteCache() {
+    // Every wallet's cache, and the one from before caches were per wallet
+    auto dir = QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation));
+    for (const auto& name : dir.entryList({ "txcache*.dat", "testnet-txcache*.dat" }, QDir::Files))
+        dir.remove(name);
+}
+
+/**
+ * Read the cache of the wallet and network that were used last, since we don't know which ones
+ * hushd has until we're connected. Returns false if there is no usable cache.
+ */
+bool TxCache::read(TxCacheData& data) {
+    QSettings s;
+    bool testnet   = s.value("cache/lasttestnet", false).toBool();
+    QString wallet = s.value("cache/lastwallet").toString();
+    if (wallet.isEmpty())
+        return false;
+
+    QFile file(writeableFile(testnet, wallet));
+    if (!file.exists() || !file.open(QIODevice::ReadOnly))
+        return false;
+
+    // Map the file instead of reading it, so the cache is parsed straight from the page cache
+    uchar* mapped = file.map(0, file.size());
+    QByteArray raw = mapped ? QByteArray::fromRawData((const char*)mapped, file.size()) : file.readAll();
+
+    QDataStream in(raw);
+    QString version;
+    in >> version;
+    if (version != cacheVersion) {
+        qDebug() << "Ignoring tx cache with version" << version;
+        return false;
+    }
+
+    in >> data.testnet >> data.height
+       >> data.balT >> data.balZ >> data.balTotal
+       >> data.tTxs >> data.zSentTxs >> data.zRecvTxs >> data.zrecvDetails
+       >> data.utxos;
+
+    if (mapped)
+        file.unmap(mapped);
+    file.close();
+
+    if (in.status() != QDataStream::Ok || data.testnet != testnet) {
+        qDebug() << "Tx cache is corrupted, ignoring it";
+        data = TxCacheData();
+        return false;
+    }
+
+    data.wallet = wallet;
+    return true;
+}
+
+void TxCache::write(const TxCacheData& data) {
+    // Write to a temp file and rename it, so a crash never leaves a half written cache
+    QSaveFile file(writeableFile(data.testnet, data.wallet));
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+
+    QDataStream out(&file);
+    out << cacheVersion << data.testnet << data.height
+        << data.balT << data.balZ << data.balTotal;
+
+    // Respect the setting to not store z txs outside of hushd. The notes of z-addresses are
+    // z txs too.
+    if (Settings::getInstance()->getSaveZtxs()) {
+        out << data.tTxs << data.zSentTxs << data.zRecvTxs << data.zrecvDetails;
+        out << data.utxos;
+    } else {
+        out << data.tTxs << QList<TransactionItem>() << QList<TransactionItem>() << QHash<QString, ZTxDetails>();
+
+        QList<UnspentOutput> tUtxos;
+        for (const auto& utxo : data.utxos) {
+            if (!Settings::isZAddress(utxo.address))
+                tUtxos.push_back(utxo);
+        }
+        out << tUtxos;
+    }
+
+    if (file.commit()) {
+        QSettings s;
+        s.setValue("cache/lasttestnet", data.testnet);
+        s.setValue("cache/lastwallet", data.wallet);
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef TXCACHE_H
+#define TXCACHE_H
+
+#include "precompiled.h"
+#include "rpc.h"
+
+// Snapshot of everything the UI shows from the wallet, so it can be displayed at startup
+// before hushd has answered anything.
+struct TxCacheData {
+    QString                     wallet;                 // TxCache::walletKey of the wallet it's from
+    bool                        testnet         = false;
+    int                         height          = 0;
+
+    double                      balT            = 0;
+    double                      balZ            = 0;
+    double                      balTotal        = 0;
+
+    QList<TransactionItem>      tTxs;
+    QList<TransactionItem>      zSentTxs;
+    QList<TransactionItem>      zRecvTxs;
+    QHash<QString, ZTxDetails>  zrecvDetails;
+
+    QList<UnspentOutput>        utxos;
+};
+
+struct ConnectionConfig;
+
+class TxCache {
+public:
+    static bool read(TxCacheData& data);
+    static void write(const TxCacheData& data);
+
+    static void deleteCache();
+
+    // Identifies a wallet by the chain and the hushd it's in, so each wallet gets its own cache
+    static QString walletKey(const ConnectionConfig& config);
+
+private:
+    static QString writeableFile(bool testnet, const QString& wallet);
+};
+
+#endif // TXCACHE_H
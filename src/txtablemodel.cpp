@@ -2,47 +2,236 @@
 #include "settings.h"
 #include "rpc.h"
 
+quint32 StringTable::intern(const QString& s) {
+    if (s.isEmpty())
+        return 0;
+
+    auto it = ids.constFind(s);
+    if (it != ids.constEnd())
+        return it.value();
+
+    quint32 id = strings.size();
+    strings.push_back(s);
+    ids.insert(s, id);
+
+    return id;
+}
+
+/**
+ * Display order of the rows: newest first. Ties are broken by the rest of the row's identity,
+ * so that the order is total and two sorted lists can be diffed in a single pass.
+ */
+static int compareRows(const TxRow& a, const TxRow& b) {
+    if (a.datetime != b.datetime)
+        return a.datetime > b.datetime ? -1 : 1;
+
+    int c = memcmp(a.txid, b.txid, sizeof(a.txid));
+    if (c != 0)
+        return c;
+
+    if (a.type != b.type)
+        return a.type < b.type ? -1 : 1;
+    if (a.address != b.address)
+        return a.address < b.address ? -1 : 1;
+    if (a.amount != b.amount)
+        return a.amount < b.amount ? -1 : 1;
+    if (a.vout != b.vout)
+        return a.vout < b.vout ? -1 : 1;
+
+    return 0;
+}
+
+static bool rowBefore(const TxRow& a, const TxRow& b) {
+    return compareRows(a, b) < 0;
+}
+
+static bool sameTx(const TxRow& a, const TxRow& b) {
+    return a.datetime == b.datetime && memcmp(a.txid, b.txid, sizeof(a.txid)) == 0;
+}
+
+// Orders a row against a cursor, by the first keys of compareRows
+static int compareToCursor(const TxRow& row, qint64 datetime, const uchar* txid) {
+    if (row.datetime != datetime)
+        return row.datetime > datetime ? -1 : 1;
+
+    return memcmp(row.txid, txid, sizeof(row.txid));
+}
+
+// A cursor's txid in binary, as in TxRow. Anything that isn't a txid sorts as all zeros.
+static void cursorTxid(const QString& txid, uchar* out) {
+    auto bin = QByteArray::fromHex(txid.toLatin1());
+    if (bin.size() == 32) {
+        memcpy(out, bin.constData(), 32);
+    } else {
+        memset(out, 0, 32);
+    }
+}
+
+// The parts of a row that can change without it becoming a different row
+static bool sameContents(const TxRow& a, const TxRow& b) {
+    return a.height == b.height && a.memo == b.memo && a.fromAddr == b.fromAddr;
+}
+
 TxTableModel::TxTableModel(QObject *parent)
      : QAbstractTableModel(parent) {
     headers << QObject::tr("Type") << QObject::tr("Address") << QObject::tr("Date/Time") << QObject::tr("Amount");
+
+    // The decorations are the same for every row, so render them just once
+    paymentReqPixmap = QIcon(":/icons/res/paymentreq.gif").pixmap(16, 16);
+    memoPixmap       = QApplication::style()->standardIcon(QStyle::SP_MessageBoxInformation).pixmap(16, 16);
+    blankPixmap      = QPixmap(16, 16);
+    blankPixmap.fill(Qt::white);
+
+    // The view gets the locale change events, so watch them there
+    if (parent != nullptr)
+        parent->installEventFilter(this);
 }
 
 TxTableModel::~TxTableModel() {
-    delete modeldata;
-    delete tTrans;
-    delete zsTrans;
-    delete zrTrans;
 }
 
-void TxTableModel::addZSentData(const QList<TransactionItem>& data) {
-    delete zsTrans;
-    zsTrans = new QList<TransactionItem>();
-    std::copy(data.begin(), data.end(), std::back_inserter(*zsTrans));
+QString TxTableModel::typeName(TxType type) {
+    switch (type) {
+    case TxType::Send:      return QStringLiteral("send");
+    case TxType::Receive:   return QStringLiteral("receive");
+    case TxType::Generate:  return QStringLiteral("generate");
+    case TxType::Immature:  return QStringLiteral("immature");
+    case TxType::Orphan:    return QStringLiteral("orphan");
+    default:                return QStringLiteral("unknown");
+    }
+}
+
+QString TxTableModel::txidHex(const TxRow& row) {
+    return QString::fromLatin1(QByteArray::fromRawData((const char*)row.txid, sizeof(row.txid)).toHex());
+}
+
+TxRow TxTableModel::toRow(const TransactionItem& tx, int height) {
+    TxRow row;
+
+    auto txid = QByteArray::fromHex(tx.txid.toLatin1());
+    if (txid.size() == sizeof(row.txid)) {
+        memcpy(row.txid, txid.constData(), sizeof(row.txid));
+    } else {
+        memset(row.txid, 0, sizeof(row.txid));
+    }
+
+    row.datetime        = tx.datetime;
+    row.amount          = std::llround(tx.amount * 100000000.0);
+    row.address         = strings.intern(tx.address);
+    row.fromAddr        = strings.intern(tx.fromAddr);
+    row.memo            = strings.intern(tx.memo);
+    row.height          = tx.confirmations > 0 ? std::max(1, height - (int)tx.confirmations + 1) : 0;
+    row.vout            = tx.vout;
+
+    if      (tx.type == "send")     row.type = TxType::Send;
+    else if (tx.type == "receive")  row.type = TxType::Receive;
+    else if (tx.type == "generate") row.type = TxType::Generate;
+    else if (tx.type == "immature") row.type = TxType::Immature;
+    else if (tx.type == "orphan")   row.type = TxType::Orphan;
+    else                            row.type = TxType::Unknown;
+
+    return row;
+}
+
+TransactionItem TxTableModel::toItem(const TxRow& row) const {
+    return TransactionItem{ typeName(row.type), row.datetime, strings.at(row.address), txidHex(row),
+                            amountOf(row), confirmationsOf(row), strings.at(row.fromAddr), strings.at(row.memo),
+                            row.vout };
+}
+
+quint32 TxTableModel::confirmationsOf(const TxRow& row) const {
+    if (row.height == 0)
+        return 0;
+    return (quint32)std::max(1, chainHeight - row.height + 1);
+}
+
+QVector<TxRow> TxTableModel::toRows(const QList<TransactionItem>& data, int height) {
+    QVector<TxRow> rows;
+    rows.reserve(data.size());
+    for (const auto& tx : data) {
+        rows.push_back(toRow(tx, height));
+    }
+
+    std::sort(rows.begin(), rows.end(), rowBefore);
+    return rows;
+}
+
+QList<TransactionItem> TxTableModel::toItems(const QVector<TxRow>& rows) const {
+    QList<TransactionItem> items;
+    items.reserve(rows.size());
+    for (const auto& row : rows) {
+        items.push_back(toItem(row));
+    }
+
+    return items;
+}
+
+void TxTableModel::addZSentData(const QList<TransactionItem>& data, int height) {
+    sourceShrunk |= data.size() < zsTrans.size();
+    zsTrans = toRows(data, height);
 
     updateAllData();
 }
 
-void TxTableModel::addZRecvData(const QList<TransactionItem>& data) {
-    delete zrTrans;
-    zrTrans = new QList<TransactionItem>();
-    std::copy(data.begin(), data.end(), std::back_inserter(*zrTrans));
+void TxTableModel::addZRecvData(const QList<TransactionItem>& data, int height) {
+    sourceShrunk |= data.size() < zrTrans.size();
+    zrTrans = toRows(data, height);
 
     updateAllData();
 }
 
 
-void TxTableModel::addTData(const QList<TransactionItem>& data) {
-    delete tTrans;
-    tTrans = new QList<TransactionItem>();
-    std::copy(data.begin(), data.end(), std::back_inserter(*tTrans));
+void TxTableModel::addTData(const QList<TransactionItem>& data, int height) {
+    sourceShrunk |= data.size() < tTrans.size();
+    tTrans = toRows(data, height);
 
     updateAllData();
 }
 
-bool TxTableModel::exportToCsv(QString fileName) const {
-    if (!modeldata)
-        return false;
+/**
+ * Apply an incremental update to the transparent txs. Every tx output in delta replaces the
+ * existing row for it (or is added if it's new). Unconfirmed rows that delta doesn't have anymore
+ * left the mempool, or were conflicted, so they're dropped. The other rows stay as they are, since
+ * their confirmations are counted from the block they're in.
+ */
+void TxTableModel::patchTData(const QList<TransactionItem>& delta, int height) {
+    // A tx that sends to the wallet itself has a send and a receive for the same output
+    auto fnKey = [=] (const TxRow& row) {
+        QByteArray key((const char*)row.txid, sizeof(row.txid));
+        key.append((const char*)&row.vout, sizeof(row.vout));
+        key.append(row.type == TxType::Send ? 's' : 'r');
+        return key;
+    };
+
+    QHash<QByteArray, TxRow> reported;
+    for (const auto& tx : delta) {
+        auto row = toRow(tx, height);
+        reported[fnKey(row)] = row;
+    }
+
+    QVector<TxRow> patched;
+    patched.reserve(tTrans.size() + reported.size());
+    for (const auto& row : tTrans) {
+        if (reported.contains(fnKey(row)))
+            continue;
+
+        if (row.height == 0) {
+            sourceShrunk = true;
+            continue;
+        }
 
+        patched.push_back(row);
+    }
+
+    for (const auto& row : reported)
+        patched.push_back(row);
+
+    std::sort(patched.begin(), patched.end(), rowBefore);
+    tTrans = patched;
+    updateAllData();
+}
+
+bool TxTableModel::exportToCsv(QString fileName) const {
     QFile file(fileName);
     if (!file.open(QIODevice::ReadWrite | QIODevice::Truncate))
         return false;
@@ -55,14 +244,14 @@ bool TxTableModel::exportToCsv(QString fileName) const {
     }
     out << "\"Memo\"";
     out << endl;
-    
+
     // Write out each row
-    for (int row = 0; row < modeldata->length(); row++) {
+    for (int row = 0; row < modeldata.size(); row++) {
         for (int col = 0; col < headers.length(); col++) {
             out << "\"" << data(index(row, col), Qt::DisplayRole).toString() << "\",";
         }
         // Memo
-        out << "\"" << modeldata->at(row).memo << "\"";
+        out << "\"" << strings.at(modeldata.at(row).memo) << "\"";
         out << endl;
     }
 
@@ -70,30 +259,168 @@ bool TxTableModel::exportToCsv(QString fileName) const {
     return true;
 }
 
-void TxTableModel::updateAllData() {    
-    auto newmodeldata = new QList<TransactionItem>();
+void TxTableModel::updateAllData() {
+    applyDiff(mergeSources());
 
-    if (tTrans  != nullptr) std::copy( tTrans->begin(),  tTrans->end(), std::back_inserter(*newmodeldata));
-    if (zsTrans != nullptr) std::copy(zsTrans->begin(), zsTrans->end(), std::back_inserter(*newmodeldata));
-    if (zrTrans != nullptr) std::copy(zrTrans->begin(), zrTrans->end(), std::back_inserter(*newmodeldata));
+    // Rows that were replaced or dropped, eg. by deleting the history or a full resync, leave
+    // their strings behind in the table
+    if (sourceShrunk || strings.size() > 2 * compactedSize + 1024)
+        compactStrings();
+}
 
-    // Sort by reverse time
-    std::sort(newmodeldata->begin(), newmodeldata->end(), [=] (auto a, auto b) {
-        return a.datetime > b.datetime; // reverse sort
-    });
+// Rebuild the string table from the rows that are left, which frees everything else
+void TxTableModel::compactStrings() {
+    StringTable compacted;
+    auto fnRemap = [&] (QVector<TxRow>& rows) {
+        for (auto& row : rows) {
+            row.address  = compacted.intern(strings.at(row.address));
+            row.fromAddr = compacted.intern(strings.at(row.fromAddr));
+            row.memo     = compacted.intern(strings.at(row.memo));
+        }
+    };
+
+    // modeldata is the merge of the sources, so remapping it doesn't add any strings
+    fnRemap(tTrans);
+    fnRemap(zsTrans);
+    fnRemap(zrTrans);
+    fnRemap(modeldata);
+
+    strings       = std::move(compacted);
+    compactedSize = strings.size();
+    sourceShrunk  = false;
+}
+
+// k-way merge of the (already sorted) sources into display order
+QVector<TxRow> TxTableModel::mergeSources() const {
+    const QVector<TxRow>* sources[] = { &tTrans, &zsTrans, &zrTrans };
+    const int k = sizeof(sources) / sizeof(sources[0]);
+    int heads[k] = {};
+
+    QVector<TxRow> merged;
+    merged.reserve(tTrans.size() + zsTrans.size() + zrTrans.size());
+
+    while (true) {
+        int next = -1;
+        for (int s = 0; s < k; s++) {
+            if (heads[s] == sources[s]->size())
+                continue;
+
+            if (next < 0 || rowBefore(sources[s]->at(heads[s]), sources[next]->at(heads[next])))
+                next = s;
+        }
+
+        if (next < 0)
+            break;
+
+        merged.push_back(sources[next]->at(heads[next]++));
+    }
+
+    return merged;
+}
+
+/**
+ * Turn modeldata into newdata, telling the view only about the rows that were actually removed,
+ * inserted or changed. Both lists are in display order, so a single pass over them is enough.
+ */
+void TxTableModel::applyDiff(const QVector<TxRow>& newdata) {
+    // Nothing to diff against, so just reset
+    if (modeldata.isEmpty() || newdata.isEmpty()) {
+        beginResetModel();
+        modeldata = newdata;
+        displayCache = QVector<TxRowStrings>(modeldata.size());
+        endResetModel();
+        return;
+    }
+
+    int changedFirst = -1;
+    int changedLast  = -1;
+    auto fnFlushChanged = [&] () {
+        if (changedFirst >= 0) {
+            emit dataChanged(index(changedFirst, 0), index(changedLast, columnCount(QModelIndex()) - 1));
+            changedFirst = changedLast = -1;
+        }
+    };
+
+    int p = 0;      // Position in modeldata, which is updated as we go along
+    int i = 0;      // Position in newdata
+    while (p < modeldata.size() || i < newdata.size()) {
+        if (p < modeldata.size() && (i == newdata.size() || rowBefore(modeldata.at(p), newdata.at(i)))) {
+            // A run of rows that are no longer there
+            int q = p;
+            while (q < modeldata.size() && (i == newdata.size() || rowBefore(modeldata.at(q), newdata.at(i))))
+                q++;
+
+            fnFlushChanged();
+            beginRemoveRows(QModelIndex(), p, q - 1);
+            modeldata.remove(p, q - p);
+            displayCache.remove(p, q - p);
+            endRemoveRows();
+        } else if (i < newdata.size() && (p == modeldata.size() || rowBefore(newdata.at(i), modeldata.at(p)))) {
+            // A run of new rows
+            int j = i;
+            while (j < newdata.size() && (p == modeldata.size() || rowBefore(newdata.at(j), modeldata.at(p))))
+                j++;
+
+            fnFlushChanged();
+            beginInsertRows(QModelIndex(), p, p + (j - i) - 1);
+            modeldata.insert(p, j - i, TxRow());
+            std::copy(newdata.constBegin() + i, newdata.constBegin() + j, modeldata.begin() + p);
+            displayCache.insert(p, j - i, TxRowStrings());
+            endInsertRows();
+
+            p += j - i;
+            i = j;
+        } else {
+            // Same row, but it might have been mined, or have a memo now
+            if (!sameContents(modeldata.at(p), newdata.at(i))) {
+                modeldata[p] = newdata.at(i);
+                displayCache[p] = TxRowStrings();
+
+                if (changedFirst >= 0 && changedLast == p - 1) {
+                    changedLast = p;
+                } else {
+                    fnFlushChanged();
+                    changedFirst = changedLast = p;
+                }
+            }
+
+            p++;
+            i++;
+        }
+    }
+
+    fnFlushChanged();
+}
 
-    // And then swap out the modeldata with the new one.
-    delete modeldata;
-    modeldata = newmodeldata;
+void TxTableModel::invalidateFormatting() {
+    displayCache.fill(TxRowStrings());
 
-    dataChanged(index(0, 0), index(modeldata->size()-1, columnCount(index(0,0))-1));
-    layoutChanged();
+    if (!modeldata.isEmpty())
+        emit dataChanged(index(0, 0), index(modeldata.size() - 1, columnCount(QModelIndex()) - 1));
+}
+
+bool TxTableModel::eventFilter(QObject* watched, QEvent* event) {
+    if (event->type() == QEvent::LocaleChange)
+        invalidateFormatting();
+
+    return QAbstractTableModel::eventFilter(watched, event);
+}
+
+const TxRowStrings& TxTableModel::rowStrings(int row) const {
+    auto& cached = displayCache[row];
+    if (!cached.valid) {
+        const auto& dat = modeldata.at(row);
+        cached.date   = QDateTime::fromSecsSinceEpoch(dat.datetime).toString();
+        cached.amount = Settings::getDisplayFormat(amountOf(dat));
+        cached.valid  = true;
+    }
+
+    return cached;
 }
 
  int TxTableModel::rowCount(const QModelIndex&) const
  {
-    if (modeldata == nullptr) return 0;
-    return modeldata->size();
+    return modeldata.size();
  }
 
  int TxTableModel::columnCount(const QModelIndex&) const
@@ -106,74 +433,65 @@ void TxTableModel::updateAllData() {
  {
      // Align column 4 (amount) right
     if (role == Qt::TextAlignmentRole && index.column() == 3) return QVariant(Qt::AlignRight | Qt::AlignVCenter);
-    
+
     if (role == Qt::ForegroundRole) {
-        if (modeldata->at(index.row()).confirmations == 0) {
-            QBrush b;
-            b.setColor(Qt::red);
-            return b;
-        }
+        static const QBrush unconfirmed(Qt::red);
+        static const QBrush confirmed(Qt::black);
 
-        // Else, just return the default brush
-        QBrush b;
-        b.setColor(Qt::black);
-        return b;        
+        return modeldata.at(index.row()).height == 0 ? unconfirmed : confirmed;
     }
 
-    auto dat = modeldata->at(index.row());
+    const auto& dat = modeldata.at(index.row());
+    const auto& memo = strings.at(dat.memo);
     if (role == Qt::DisplayRole) {
         switch (index.column()) {
-        case 0: return dat.type;
-        case 1: { 
-                    auto addr = modeldata->at(index.row()).address;
-                    if (addr.trimmed().isEmpty()) 
-                        return "(Shielded)";
-                    else 
+        case 0: return typeName(dat.type);
+        case 1: {
+                    const auto& addr = strings.at(dat.address);
+                    if (addr.trimmed().isEmpty())
+                        return QStringLiteral("(Shielded)");
+                    else
                         return addr;
                 }
-        case 2: return QDateTime::fromMSecsSinceEpoch(modeldata->at(index.row()).datetime *  (qint64)1000).toLocalTime().toString();
-        case 3: return Settings::getDisplayFormat(modeldata->at(index.row()).amount);
+        case 2: return rowStrings(index.row()).date;
+        case 3: return rowStrings(index.row()).amount;
         }
-    } 
+    }
 
     if (role == Qt::ToolTipRole) {
         switch (index.column()) {
-        case 0: { 
-                    if (dat.memo.startsWith("hush:")) {
-                        return Settings::paymentURIPretty(Settings::parseURI(dat.memo));
+        case 0: {
+                    if (memo.startsWith("hush:")) {
+                        return Settings::paymentURIPretty(Settings::parseURI(memo));
                     } else {
-                        return modeldata->at(index.row()).type + 
-                        (dat.memo.isEmpty() ? "" : " tx memo: \"" + dat.memo.toHtmlEscaped() + "\"");
+                        return typeName(dat.type) +
+                        (memo.isEmpty() ? "" : " tx memo: \"" + memo.toHtmlEscaped() + "\"");
                     }
                 }
-        case 1: { 
-                    auto addr = modeldata->at(index.row()).address;
-                    if (addr.trimmed().isEmpty()) 
-                        return "(Shielded)";
-                    else 
+        case 1: {
+                    const auto& addr = strings.at(dat.address);
+                    if (addr.trimmed().isEmpty())
+                        return QStringLiteral("(Shielded)");
+                    else
                         return addr;
                 }
-        case 2: return QDateTime::fromMSecsSinceEpoch(modeldata->at(index.row()).datetime * (qint64)1000).toLocalTime().toString();
-        case 3: return Settings::getInstance()->getUSDFormat(modeldata->at(index.row()).amount);
-        }    
+        case 2: return rowStrings(index.row()).date;
+        case 3: return Settings::getInstance()->getUSDFormat(amountOf(dat));
+        }
     }
 
     if (role == Qt::DecorationRole && index.column() == 0) {
-        if (!dat.memo.isEmpty()) {
+        if (!memo.isEmpty()) {
             // If the memo is a Payment URI, then show a payment request icon
-            if (dat.memo.startsWith("hush:")) {
-                QIcon icon(":/icons/res/paymentreq.gif");
-                return QVariant(icon.pixmap(16, 16));
+            if (memo.startsWith("hush:")) {
+                return QVariant(paymentReqPixmap);
             } else {
                 // Return the info pixmap to indicate memo
-                QIcon icon = QApplication::style()->standardIcon(QStyle::SP_MessageBoxInformation);            
-                return QVariant(icon.pixmap(16, 16));
-                }
+                return QVariant(memoPixmap);
+            }
         } else {
             // Empty pixmap to make it align
-            QPixmap p(16, 16);
-            p.fill(Qt::white);
-            return QVariant(p);
+            return QVariant(blankPixmap);
         }
     }
 
@@ -198,30 +516,71 @@ void TxTableModel::updateAllData() {
      return QVariant();
  }
 
+int TxTableModel::cursorStart(qint64 datetime, const QString& txid) const {
+    uchar bin[32];
+    cursorTxid(txid, bin);
+
+    auto it = std::partition_point(modeldata.begin(), modeldata.end(), [&] (const TxRow& row) {
+        return compareToCursor(row, datetime, bin) < 0;
+    });
+    return int(it - modeldata.begin());
+}
+
+int TxTableModel::cursorEnd(qint64 datetime, const QString& txid) const {
+    uchar bin[32];
+    cursorTxid(txid, bin);
+
+    auto it = std::partition_point(modeldata.begin(), modeldata.end(), [&] (const TxRow& row) {
+        return compareToCursor(row, datetime, bin) <= 0;
+    });
+    return int(it - modeldata.begin());
+}
+
+int TxTableModel::txStart(int row) const {
+    while (row > 0 && sameTx(modeldata.at(row - 1), modeldata.at(row)))
+        row--;
+    return row;
+}
+
+int TxTableModel::txEnd(int row) const {
+    while (row + 1 < modeldata.size() && sameTx(modeldata.at(row), modeldata.at(row + 1)))
+        row++;
+    return row + 1;
+}
+
 QString TxTableModel::getTxId(int row) const {
-    return modeldata->at(row).txid;
+    return txidHex(modeldata.at(row));
+}
+
+QSet<QString> TxTableModel::getUnconfirmedTxIds() const {
+    QSet<QString> txids;
+    for (const auto& row : modeldata) {
+        if (row.height == 0)
+            txids.insert(txidHex(row));
+    }
+    return txids;
 }
 
 QString TxTableModel::getMemo(int row) const {
-    return modeldata->at(row).memo;
+    return strings.at(modeldata.at(row).memo);
 }
 
 qint64 TxTableModel::getConfirmations(int row) const {
-    return modeldata->at(row).confirmations;
+    return confirmationsOf(modeldata.at(row));
 }
 
 QString TxTableModel::getAddr(int row) const {
-    return modeldata->at(row).address.trimmed();
+    return strings.at(modeldata.at(row).address).trimmed();
 }
 
 qint64 TxTableModel::getDate(int row) const {
-    return modeldata->at(row).datetime;
+    return modeldata.at(row).datetime;
 }
 
 QString TxTableModel::getType(int row) const {
-    return modeldata->at(row).type;
+    return typeName(modeldata.at(row).type);
 }
 
 QString TxTableModel::getAmt(int row) const {
-    return Settings::getDecimalString(modeldata->at(row).amount);
+    return Settings::getDecimalString(amountOf(modeldata.at(row)));
 }
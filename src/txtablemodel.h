@@ -5,17 +5,69 @@
 
 struct TransactionItem;
 
+// Stores each distinct string (address, memo) once. Rows refer to strings by their id.
+// Id 0 is always the empty string.
+class StringTable {
+public:
+    StringTable() { strings.push_back(QString()); }
+
+    quint32         intern(const QString& s);
+    const QString&  at(quint32 id) const { return strings.at(id); }
+    int             size() const         { return strings.size(); }
+
+private:
+    QVector<QString>         strings;
+    QHash<QString, quint32>  ids;
+};
+
+enum class TxType : quint8 {
+    Send = 0,
+    Receive,
+    Generate,
+    Immature,
+    Orphan,
+    Unknown
+};
+
+// Compact, fixed size form of a TransactionItem, as stored in the model.
+struct TxRow {
+    uchar           txid[32];           // Binary txid, in the same byte order as the hex
+    qint64          datetime;
+    qint64          amount;             // In zatoshis
+    quint32         address;            // Id in the model's StringTable
+    quint32         fromAddr;           // Id in the model's StringTable
+    quint32         memo;               // Id in the model's StringTable, 0 if there is no memo
+    qint32          height;             // Block the tx was mined in, 0 if unconfirmed
+    qint32          vout;               // -1 for z-txs
+    TxType          type;
+};
+
+// Formatted strings for a row, made the first time the row is painted
+struct TxRowStrings {
+    bool            valid = false;
+    QString         date;
+    QString         amount;
+};
+
 class TxTableModel: public QAbstractTableModel
 {
 public:
-    TxTableModel(QObject* parent);    
+    TxTableModel(QObject* parent);
     ~TxTableModel();
 
-    void addTData    (const QList<TransactionItem>& data);
-    void addZSentData(const QList<TransactionItem>& data);
-    void addZRecvData(const QList<TransactionItem>& data);     
+    // The confirmations in data are counted from the chain at height
+    void addTData    (const QList<TransactionItem>& data, int height);
+    void addZSentData(const QList<TransactionItem>& data, int height);
+    void addZRecvData(const QList<TransactionItem>& data, int height);
+
+    void patchTData  (const QList<TransactionItem>& delta, int height);
+
+    // Rows keep the block they were mined in, and confirmations are counted from this when they're
+    // asked for, so a new block doesn't change any row
+    void     setChainHeight(int height) { chainHeight = height; }
 
     QString  getTxId(int row) const;
+    QSet<QString> getUnconfirmedTxIds() const;
     QString  getMemo(int row) const;
     QString  getAddr(int row) const;
     qint64   getDate(int row) const;
@@ -23,21 +75,69 @@ public:
     qint64   getConfirmations(int row) const;
     QString  getAmt (int row) const;
 
+    // Rows are in display order, newest first. A cursor is the datetime and txid of a row, which
+    // all the rows of the same tx share. cursorStart is the first row of the cursor's tx (or where
+    // it would be), cursorEnd the first row after it.
+    int      cursorStart(qint64 datetime, const QString& txid) const;
+    int      cursorEnd  (qint64 datetime, const QString& txid) const;
+
+    // The first row of the tx that row belongs to, and the first row after that tx
+    int      txStart(int row) const;
+    int      txEnd  (int row) const;
+
+    QList<TransactionItem> getTData()     const { return toItems(tTrans);  }
+    QList<TransactionItem> getZSentData() const { return toItems(zsTrans); }
+    QList<TransactionItem> getZRecvData() const { return toItems(zrTrans); }
+
     bool     exportToCsv(QString fileName) const;
 
+    // Drop all the formatted strings, for eg. when the locale changes
+    void     invalidateFormatting();
+
     int      rowCount(const QModelIndex &parent) const;
     int      columnCount(const QModelIndex &parent) const;
     QVariant data(const QModelIndex &index, int role) const;
     QVariant headerData(int section, Qt::Orientation orientation, int role) const;
 
+protected:
+    bool     eventFilter(QObject* watched, QEvent* event);
+
 private:
     void updateAllData();
+    void compactStrings();
+    QVector<TxRow>          mergeSources() const;
+    void                    applyDiff(const QVector<TxRow>& newdata);
+
+    TxRow                   toRow(const TransactionItem& tx, int height);
+    TransactionItem         toItem(const TxRow& row) const;
+    QVector<TxRow>          toRows(const QList<TransactionItem>& data, int height);
+    quint32                 confirmationsOf(const TxRow& row) const;
+    QList<TransactionItem>  toItems(const QVector<TxRow>& rows) const;
+
+    const TxRowStrings&     rowStrings(int row) const;
+
+    static QString          typeName(TxType type);
+    static QString          txidHex(const TxRow& row);
+    static double           amountOf(const TxRow& row) { return row.amount / 100000000.0; }
+
+    // Each source is kept sorted in display order, so they can be merged without sorting again
+    QVector<TxRow>           tTrans;
+    QVector<TxRow>           zrTrans;     // Z received
+    QVector<TxRow>           zsTrans;     // Z sent
+
+    QVector<TxRow>           modeldata;
+
+    int                      chainHeight    = 0;
+
+    StringTable              strings;
+    int                      compactedSize  = 0;        // Size of strings after the last compaction
+    bool                     sourceShrunk   = false;    // Rows were dropped since the last compaction
 
-    QList<TransactionItem>*  tTrans      = nullptr;
-    QList<TransactionItem>*  zrTrans     = nullptr;     // Z received
-    QList<TransactionItem>*  zsTrans     = nullptr;     // Z sent
+    mutable QVector<TxRowStrings>  displayCache;    // Same rows as modeldata
 
-    QList<TransactionItem>* modeldata    = nullptr;
+    QPixmap                  paymentReqPixmap;
+    QPixmap                  memoPixmap;
+    QPixmap                  blankPixmap;
 
     QList<QString>           headers;
 };
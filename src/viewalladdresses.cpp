@@ -6,6 +6,7 @@ ViewAllAddressesModel::ViewAllAddressesModel(QTableView *parent, QList<QString>
     headers << tr("Address") << tr("Balance (%1)").arg(Settings::getTokenName());
     addresses = taddrs;
     this->rpc = rpc;
+    state = rpc->getWalletState();
 }
 
 
@@ -22,7 +23,7 @@ QVariant ViewAllAddressesModel::data(const QModelIndex &index, int role) const {
     if (role == Qt::DisplayRole) {
         switch(index.column()) {
             case 0: return address;
-            case 1: return rpc->getAllBalances()->value(address, 0.0);
+            case 1: return state ? state->getBalance(address) : 0.0;
         }
     }
     return QVariant();
@@ -19,6 +19,7 @@ private:
     QList<QString> addresses;
     QStringList headers;    
     RPC* rpc;
+    WalletStatePtr state;       // Balances as of when the dialog was opened
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+#include "walletstate.h"
+
+WalletState::WalletState(const QList<UnspentOutput>& utxos) {
+    for (const auto& utxo : utxos) {
+        auto& state = byAddress[utxo.address];
+        state.balance += utxo.amount;
+        state.utxos.push_back(utxo);
+
+        if (utxo.confirmations == 0) {
+            state.anyUnconfirmed = true;
+            unconfirmed = true;
+        }
+    }
+
+    addresses.reserve(byAddress.size());
+    for (auto it = byAddress.constBegin(); it != byAddress.constEnd(); it++) {
+        addresses.push_back(it.key());
+    }
+    std::sort(addresses.begin(), addresses.end());
+}
+
+qint64 WalletState::getBalanceZats(const QString& addr) const {
+    auto it = byAddress.constFind(addr);
+    return it == byAddress.constEnd() ? 0 : it.value().balance;
+}
+
+bool WalletState::hasUnconfirmed(const QString& addr) const {
+    auto it = byAddress.constFind(addr);
+    return it != byAddress.constEnd() && it.value().anyUnconfirmed;
+}
+
+const QVector<UnspentOutput>& WalletState::getUTXOs(const QString& addr) const {
+    static const QVector<UnspentOutput> none;
+
+    auto it = byAddress.constFind(addr);
+    return it == byAddress.constEnd() ? none : it.value().utxos;
+}
+
+QList<UnspentOutput> WalletState::getAllUTXOs() const {
+    QList<UnspentOutput> all;
+    for (const auto& addr : addresses) {
+        for (const auto& utxo : byAddress[addr].utxos) {
+            all.push_back(utxo);
+        }
+    }
+
+    return all;
+}
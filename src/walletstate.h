@@ -0,0 +1,51 @@
+#ifndef WALLETSTATE_H
+#define WALLETSTATE_H
+
+#include "precompiled.h"
+
+struct UnspentOutput {
+    QString address;
+    QString txid;
+    qint64  amount;         // In zatoshis
+    int     confirmations;
+    bool    spendable;
+};
+
+/**
+ * The balances and UTXOs of all the wallet's addresses, indexed by address. A WalletState is
+ * built once from the unspent outputs and never modified after that, so the same instance can be
+ * shared by the models and dialogs. A refresh builds a new one and swaps it in.
+ */
+class WalletState {
+public:
+    struct AddressState {
+        qint64                  balance        = 0;     // In zatoshis
+        bool                    anyUnconfirmed = false;
+        QVector<UnspentOutput>  utxos;
+    };
+
+    WalletState() = default;
+    explicit WalletState(const QList<UnspentOutput>& utxos);
+
+    qint64                          getBalanceZats(const QString& addr) const;
+    double                          getBalance(const QString& addr) const { return fromZats(getBalanceZats(addr)); }
+    bool                            hasUnconfirmed(const QString& addr) const;
+    const QVector<UnspentOutput>&   getUTXOs(const QString& addr) const;
+
+    // All addresses that have any UTXOs, sorted
+    const QVector<QString>&         getAddresses() const   { return addresses; }
+    QList<UnspentOutput>            getAllUTXOs() const;
+    bool                            anyUnconfirmed() const { return unconfirmed; }
+
+    static qint64                   toZats(double amount)  { return std::llround(amount * 100000000.0); }
+    static double                   fromZats(qint64 zats)  { return zats / 100000000.0; }
+
+private:
+    QHash<QString, AddressState>    byAddress;
+    QVector<QString>                addresses;
+    bool                            unconfirmed = false;
+};
+
+typedef std::shared_ptr<const WalletState> WalletStatePtr;
+
+#endif // WALLETSTATE_H
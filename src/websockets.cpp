@@ -6,17 +6,32 @@
 #include "ui_mobileappconnector.h"
 #include "version.h"
 
-// Wrap the sendTextMessage to check if the connection is valid and that the parent WebServer didn't close this connection
+ClientWebSocket::ClientWebSocket(QWebSocket* c, WSServer* s, bool b) {
+    client = c;
+    server = s;
+    binary = b;
+}
+
+// Check if the connection is valid and that the parent WebServer didn't close this connection
 // for some reason.
+bool ClientWebSocket::isConnected() {
+    if (!client)
+        return false;
+
+    if (server && !server->isValidConnection(client))
+        return false;
+
+    return client->isValid();
+}
+
 void ClientWebSocket::sendTextMessage(QString m) {
-    if (client) {
-        if (server && !server->isValidConnection(client)) {
-            return;
-        }
+    if (isConnected())
+        client->sendTextMessage(m);
+}
 
-        if (client->isValid())
-            client->sendTextMessage(m);
-    }
+void ClientWebSocket::sendBinaryMessage(const QByteArray& m) {
+    if (isConnected())
+        client->sendBinaryMessage(m);
 }
 
 WSServer::WSServer(quint16 port, bool debug, QObject *parent) :
@@ -39,7 +54,7 @@ WSServer::~WSServer()
 {
     qDebug() << "Closing websocket server";
     m_pWebSocketServer->close();
-    qDeleteAll(m_clients.begin(), m_clients.end());
+    qDeleteAll(m_clients.keyBegin(), m_clients.keyEnd());
     qDebug() << "Deleted all websocket clients";
 }
 
@@ -52,7 +67,7 @@ void WSServer::onNewConnection()
     connect(pSocket, &QWebSocket::binaryMessageReceived, this, &WSServer::processBinaryMessage);
     connect(pSocket, &QWebSocket::disconnected, this, &WSServer::socketDisconnected);
 
-    m_clients << pSocket;
+    m_clients[pSocket].client = std::make_shared<ClientWebSocket>(pSocket, this);
 }
 
 void WSServer::processTextMessage(QString message)
@@ -61,18 +76,71 @@ void WSServer::processTextMessage(QString message)
     if (m_debug)
         qDebug() << "Message received:" << message;
 
-    if (pClient) {
-        std::shared_ptr<ClientWebSocket> client = std::make_shared<ClientWebSocket>(pClient, this);
-        AppDataServer::getInstance()->processMessage(message, m_mainWindow, client, AppConnectionType::DIRECT);
-    }
+    if (pClient)
+        enqueue(pClient, false, message.toUtf8());
 }
 
 void WSServer::processBinaryMessage(QByteArray message)
 {
-    //QWebSocket *pClient = qobject_cast<QWebSocket *>(sender());
+    QWebSocket *pClient = qobject_cast<QWebSocket *>(sender());
     if (m_debug)
-        qDebug() << "Binary Message received:" << message;
+        qDebug() << "Binary Message received:" << message.size() << "bytes";
 
+    if (pClient)
+        enqueue(pClient, true, message);
+}
+
+void WSServer::enqueue(QWebSocket* pClient, bool binary, const QByteArray& data) {
+    if (!m_clients.contains(pClient))
+        return;
+
+    auto& state = m_clients[pClient];
+    if (state.pending.size() >= maxPendingPerClient) {
+        qDebug() << "Too many pending messages from" << pClient << ", dropping one";
+        auto r = QJsonDocument(QJsonObject{ {"error", "Too many requests"} }).toJson();
+        state.client->sendTextMessage(r);
+        return;
+    }
+
+    state.pending.enqueue(PendingMessage{ binary, data });
+    if (state.pending.size() == 1)
+        m_ready.enqueue(pClient);
+
+    if (!m_scheduled) {
+        m_scheduled = true;
+        QTimer::singleShot(0, this, &WSServer::processNext);
+    }
+}
+
+// Process one message of the client whose turn it is, and then let the event loop run before the
+// next one. A client that still has messages waiting goes to the back of the line.
+void WSServer::processNext() {
+    m_scheduled = false;
+
+    while (!m_ready.isEmpty()) {
+        auto pClient = m_ready.dequeue();
+        if (!m_clients.contains(pClient) || m_clients[pClient].pending.isEmpty())
+            continue;
+
+        // Copy what's needed, the client may disconnect while its message is processed
+        auto msg = m_clients[pClient].pending.dequeue();
+        auto client = m_clients[pClient].client;
+        if (!m_clients[pClient].pending.isEmpty())
+            m_ready.enqueue(pClient);
+
+        if (msg.binary) {
+            client->setBinary(true);
+            AppDataServer::getInstance()->processBinaryMessage(msg.data, m_mainWindow, client, AppConnectionType::DIRECT);
+        } else {
+            AppDataServer::getInstance()->processMessage(QString::fromUtf8(msg.data), m_mainWindow, client, AppConnectionType::DIRECT);
+        }
+        break;
+    }
+
+    if (!m_ready.isEmpty() && !m_scheduled) {
+        m_scheduled = true;
+        QTimer::singleShot(0, this, &WSServer::processNext);
+    }
 }
 
 void WSServer::socketDisconnected()
@@ -81,7 +149,8 @@ void WSServer::socketDisconnected()
     if (m_debug)
         qDebug() << "socketDisconnected:" << pClient;
     if (pClient) {
-        m_clients.removeAll(pClient);
+        // Anything it still had queued is dropped, and it's skipped when its turn comes
+        m_clients.remove(pClient);
         pClient->deleteLater();
     }
 }
@@ -236,11 +305,144 @@ void WormholeClient::onTextMessageReceived(QString message)
 }
 
 
+// ==============================
+// AppSession
+// ==============================
+AppSession::AppSession(const QString& secretHex) {
+    keys = static_cast<Keys*>(sodium_malloc(sizeof(Keys)));
+    if (keys == nullptr)
+        throw std::bad_alloc();
+    sodium_memzero(keys, sizeof(Keys));
+
+    auto hex = secretHex.toLatin1();
+    sodium_hex2bin(keys->secret, crypto_secretbox_KEYBYTES, hex.constData(), hex.size(), NULL, NULL, NULL);
+    sodium_memzero(hex.data(), hex.size());
+
+    // The local nonce starts from 1, to always keep it odd
+    keys->localNonce[0] = 1;
+
+    wormholeCode = AppDataServer::getInstance()->getWormholeCode(secretHex);
+    settingsGroup = settingsGroupOf(wormholeCode);
+}
+
+QString AppSession::settingsGroupOf(const QString& wormholeCode) {
+    return "mobileapp/nonces/" + wormholeCode.left(16) + "/";
+}
+
+AppSession::~AppSession() {
+    // Zeroes the memory too
+    sodium_free(keys);
+}
+
+// The app's own nonce, or defaultHex if none was saved yet
+QByteArray AppSession::savedNonce(const char* key, const QString& defaultHex) {
+    return QSettings().value(settingsGroup + key, defaultHex).toString().toLatin1();
+}
+
+void AppSession::restoreNonces() {
+    restoreLocalNonce();
+
+    auto hex = savedNonce("remotenoncehex", QString("00").repeated(crypto_secretbox_NONCEBYTES));
+    sodium_hex2bin(keys->remoteNonce, crypto_secretbox_NONCEBYTES, hex.constData(), hex.size(), NULL, NULL, NULL);
+    remoteDirty = false;
+}
+
+void AppSession::restoreLocalNonce() {
+    auto defaultLocalNonce = "01" + QString("00").repeated(crypto_secretbox_NONCEBYTES-1);
+    auto hex = savedNonce("localnoncehex", defaultLocalNonce);
+    sodium_hex2bin(keys->localNonce, crypto_secretbox_NONCEBYTES, hex.constData(), hex.size(), NULL, NULL, NULL);
+
+    // The saved nonce may already have been used, so start by reserving a new block after it
+    localNoncesLeft = 0;
+}
+
+/**
+ * Save the nonce we will have after another localNonceBlock messages, before using any of
+ * them. After a restart we continue from there, so a nonce is never used twice, even if the
+ * nonces in between were never used at all. This is the only synced write, once per block.
+ */
+void AppSession::reserveLocalNonces() {
+    uchar reserved[crypto_secretbox_NONCEBYTES];
+    memcpy(reserved, keys->localNonce, crypto_secretbox_NONCEBYTES);
+
+    // Each message moves the nonce by 2, and the nonce is little endian
+    uchar step[crypto_secretbox_NONCEBYTES] = { 0 };
+    step[0] = (2 * localNonceBlock) & 0xff;
+    step[1] = (2 * localNonceBlock) >> 8;
+    sodium_add(reserved, step, crypto_secretbox_NONCEBYTES);
+
+    char hex[crypto_secretbox_NONCEBYTES*2 + 1];
+    sodium_bin2hex(hex, sizeof(hex), reserved, crypto_secretbox_NONCEBYTES);
+
+    QSettings s;
+    s.setValue(settingsGroup + "localnoncehex", QString(hex));
+    s.sync();
+
+    localNoncesLeft = localNonceBlock;
+}
+
+void AppSession::checkpointNonces(bool sync) {
+    if (!remoteDirty)
+        return;
+
+    char hex[crypto_secretbox_NONCEBYTES*2 + 1];
+    sodium_bin2hex(hex, sizeof(hex), keys->remoteNonce, crypto_secretbox_NONCEBYTES);
+
+    QSettings s;
+    s.setValue(settingsGroup + "remotenoncehex", QString(hex));
+    if (sync)
+        s.sync();
+    remoteDirty = false;
+}
+
+QByteArray AppSession::seal(const QByteArray& msg, int reserved) {
+    if (localNoncesLeft == 0)
+        reserveLocalNonces();
+    localNoncesLeft--;
+
+    // Increment the nonce +2
+    sodium_increment(keys->localNonce, crypto_secretbox_NONCEBYTES);
+    sodium_increment(keys->localNonce, crypto_secretbox_NONCEBYTES);
+
+    QByteArray out(reserved + crypto_secretbox_NONCEBYTES + crypto_secretbox_MACBYTES + msg.size(), '\0');
+    auto p = reinterpret_cast<uchar*>(out.data()) + reserved;
+
+    memcpy(p, keys->localNonce, crypto_secretbox_NONCEBYTES);
+    crypto_secretbox_easy(p + crypto_secretbox_NONCEBYTES, reinterpret_cast<const uchar*>(msg.constData()), msg.size(),
+                          keys->localNonce, keys->secret);
+    return out;
+}
+
+bool AppSession::open(const uchar* nonce, const uchar* ciphertext, int len, QByteArray* msg) {
+    if (len < (int)crypto_secretbox_MACBYTES)
+        return false;
+
+    // Check to make sure that the nonce is greater than the last known remote nonce
+    if (sodium_compare(keys->remoteNonce, nonce, crypto_secretbox_NONCEBYTES) != -1) {
+        qDebug() << "Repeated nonce detected, potential attack or misconfiguration! Bailing out.";
+        return false;
+    }
+
+    QByteArray decrypted(len - crypto_secretbox_MACBYTES, '\0');
+    if (crypto_secretbox_open_easy(reinterpret_cast<uchar*>(decrypted.data()), ciphertext, len, nonce, keys->secret) != 0)
+        return false;
+
+    // Update the last seen remote nonce
+    memcpy(keys->remoteNonce, nonce, crypto_secretbox_NONCEBYTES);
+    remoteDirty = true;
+
+    *msg = decrypted;
+    return true;
+}
+
 // ==============================
 // AppDataServer
 // ==============================
 AppDataServer* AppDataServer::instance = nullptr;
 
+// Enforce limits on the size of incoming messages
+static const int maxEncryptedSize = 50*1024; // 50kb
+
 QString AppDataServer::getWormholeCode(QString secretHex) {
     qDebug() << "AppDataServer::getWormholeCode";
     unsigned char* secret = new unsigned char[crypto_secretbox_KEYBYTES];
@@ -273,8 +475,54 @@ QString AppDataServer::getSecretHex() {
     return s.value("mobileapp/secret", "").toString();
 }
 
+/**
+ * Pair a new app. Its secret becomes the primary one, which the wormhole uses, and the apps that
+ * were paired before it can still connect directly. An empty secret disconnects all apps.
+ */
 void AppDataServer::saveNewSecret(QString secretHex) {
-    QSettings().setValue("mobileapp/secret", secretHex);
+    // The legacy nonces belong to the primary secret, which is about to change
+    migrateLegacyNonces();
+
+    QSettings s;
+    QStringList others;
+    if (secretHex.isEmpty()) {
+        s.remove("mobileapp/nonces");
+    } else {
+        others = s.value("mobileapp/othersecrets").toStringList();
+        auto previous = getSecretHex();
+        if (!previous.isEmpty())
+            others.prepend(previous);
+        others.removeAll(secretHex);
+
+        // The nonces of an app that's evicted are never needed again
+        while (others.size() > maxPairedApps - 1)
+            s.remove(AppSession::settingsGroupOf(getWormholeCode(others.takeLast())));
+    }
+
+    s.setValue("mobileapp/secret", secretHex);
+    s.setValue("mobileapp/othersecrets", others);
+
+    // Apps that stay paired keep their sessions, and with them the nonces they're at. Only the new
+    // app gets a session, and the ones that were dropped lose theirs.
+    if (sessionsLoaded) {
+        QList<std::shared_ptr<AppSession>> kept;
+        if (!secretHex.isEmpty()) {
+            others.prepend(secretHex);
+            for (const auto& hex : others) {
+                auto code = getWormholeCode(hex);
+                auto it = std::find_if(sessions.begin(), sessions.end(),
+                                       [&] (const std::shared_ptr<AppSession>& session) { return session->getWormholeCode() == code; });
+                if (it != sessions.end()) {
+                    kept.push_back(*it);
+                } else {
+                    auto session = std::make_shared<AppSession>(hex);
+                    session->restoreNonces();
+                    kept.push_back(session);
+                }
+            }
+        }
+        sessions = kept;
+    }
 
     if (secretHex.isEmpty())
         setAllowInternetConnection(false);
@@ -301,6 +549,9 @@ void AppDataServer::saveLastSeenTime() {
 }
 
 QDateTime  AppDataServer::getLastSeenTime() {
+    // Messages only update lastSeen, it's saved at the next checkpoint
+    if (lastSeen > 0)
+        return QDateTime::fromSecsSinceEpoch(lastSeen);
     return QDateTime::fromSecsSinceEpoch(QSettings().value("mobileapp/lastseentime", 0).toLongLong());
 }
 
@@ -452,176 +703,154 @@ void AppDataServer::updateConnectedUI() {
     ui->btnDisconnect->setEnabled(!remoteName.isEmpty());
 }
 
-QString AppDataServer::getNonceHex(NonceType nt) {
-    QSettings s;
-    QString hex;
-    if (nt == NonceType::LOCAL) {
-        // The default local nonce starts from 1, to always keep it odd
-        auto defaultLocalNonce = "01" + QString("00").repeated(crypto_secretbox_NONCEBYTES-1);
-        hex = s.value("mobileapp/localnoncehex", defaultLocalNonce).toString();
-    }
-    else {
-        hex = s.value("mobileapp/remotenoncehex", QString("00").repeated(crypto_secretbox_NONCEBYTES)).toString();
+// The sessions of all the paired apps, the primary one first. Empty if no app is connected.
+const QList<std::shared_ptr<AppSession>>& AppDataServer::getSessions() {
+    if (!sessionsLoaded) {
+        sessionsLoaded = true;
+        migrateLegacyNonces();
+
+        auto secrets = QSettings().value("mobileapp/othersecrets").toStringList();
+        auto primary = getSecretHex();
+        if (!primary.isEmpty())
+            secrets.prepend(primary);
+        else
+            secrets.clear();
+
+        for (const auto& secretHex : secrets) {
+            auto session = std::make_shared<AppSession>(secretHex);
+            session->restoreNonces();
+            sessions.push_back(session);
+        }
     }
-    return hex;
+    return sessions;
 }
 
-void AppDataServer::saveNonceHex(NonceType nt, QString noncehex) {
+/**
+ * Before more than one app could be paired, the nonces were kept outside of any group. They belong
+ * to the app whose secret was mobileapp/secret then, which stays the primary one until the next
+ * app is paired, so they're moved into its group before that can happen.
+ */
+void AppDataServer::migrateLegacyNonces() {
     QSettings s;
-    assert(noncehex.length() == crypto_secretbox_NONCEBYTES * 2);
-    if (nt == NonceType::LOCAL) {
-        s.setValue("mobileapp/localnoncehex", noncehex);
-    }
-    else {
-        s.setValue("mobileapp/remotenoncehex", noncehex);
-    }
-    s.sync();
-}
+    const QStringList keys = { "localnoncehex", "remotenoncehex" };
 
-// Encrypt an outgoing message with the stored secret key.
-QString AppDataServer::encryptOutgoing(QString msg) {
-    // This padding size is ~50% larger than current largest
-    // message size and makes all current message types
-    // indistinguishable. If some new message type can
-    // be larger than this, the padding should probably be increased
-    int padding = 16*1024;
-    qDebug() << "Encrypt msg(pad="<<padding<<")  prepad len=" << msg.length();
-    if (msg.length() % padding > 0) {
-        msg = msg + QString(" ").repeated(padding - (msg.length() % padding));
+    auto primary = getSecretHex();
+    auto group = primary.isEmpty() ? QString() : AppSession::settingsGroupOf(getWormholeCode(primary));
+    for (const auto& key : keys) {
+        if (!s.contains("mobileapp/" + key))
+            continue;
+
+        if (!group.isEmpty() && !s.contains(group + key))
+            s.setValue(group + key, s.value("mobileapp/" + key));
+        s.remove("mobileapp/" + key);
     }
-    qDebug() << "Encrypt msg postpad len=" << msg.length();
+}
 
-    QString localNonceHex = getNonceHex(NonceType::LOCAL);
+void AppDataServer::checkpointNonces() {
+    for (const auto& session : sessions)
+        session->checkpointNonces();
 
-    unsigned char* noncebin = new unsigned char[crypto_secretbox_NONCEBYTES];
-    sodium_hex2bin(noncebin, crypto_secretbox_NONCEBYTES, localNonceHex.toStdString().c_str(), localNonceHex.length(),
-        NULL, NULL, NULL);
+    if (lastSeen > 0)
+        QSettings().setValue("mobileapp/lastseentime", lastSeen);
+}
 
-    // Increment the nonce +2 and save
-    sodium_increment(noncebin, crypto_secretbox_NONCEBYTES);
-    sodium_increment(noncebin, crypto_secretbox_NONCEBYTES);
+// Checkpoint at most a second after a message, instead of writing to disk for every one of them
+void AppDataServer::scheduleCheckpoint() {
+    if (checkpointTimer == nullptr) {
+        checkpointTimer = new QTimer();
+        checkpointTimer->setSingleShot(true);
+        checkpointTimer->setInterval(1000);
+        QObject::connect(checkpointTimer, &QTimer::timeout, [=] () { checkpointNonces(); });
+    }
 
-    char* newLocalNonce = new char[crypto_secretbox_NONCEBYTES*2 + 1];
-    sodium_memzero(newLocalNonce, crypto_secretbox_NONCEBYTES*2 + 1);
-    sodium_bin2hex(newLocalNonce, crypto_secretbox_NONCEBYTES*2+1, noncebin, crypto_box_NONCEBYTES);
+    if (!checkpointTimer->isActive())
+        checkpointTimer->start();
+}
 
-    saveNonceHex(NonceType::LOCAL, QString(newLocalNonce));
+void AppDataServer::markSeen(AppConnectionType connType) {
+    lastSeen = QDateTime::currentSecsSinceEpoch();
+    if (getLastConnectionType() != connType)
+        saveLastConnectedOver(connType);
 
-    unsigned char* secret = new unsigned char[crypto_secretbox_KEYBYTES];
-    sodium_hex2bin(secret, crypto_secretbox_KEYBYTES, getSecretHex().toStdString().c_str(), crypto_secretbox_KEYBYTES*2, 
-        NULL, NULL, NULL);
+    scheduleCheckpoint();
+}
 
-    int msgSize = strlen(msg.toStdString().c_str());
-    unsigned char* encrpyted = new unsigned char[ msgSize + crypto_secretbox_MACBYTES];
+// replyPadding is ~50% larger than current largest
+// message size and makes all current message types
+// indistinguishable. If some new message type can
+// be larger than this, the padding should probably be increased.
+// Events are small and all of about the same size, so eventPadding
+// is enough to hide which one was sent.
+static QByteArray padOutgoing(const QByteArray& msg, int padding) {
+    qDebug() << "Encrypt msg(pad="<<padding<<")  prepad len=" << msg.length();
+    if (msg.length() % padding == 0)
+        return msg;
 
-    crypto_secretbox_easy(encrpyted, (const unsigned char *)msg.toStdString().c_str(), msgSize, noncebin, secret);
+    return msg + QByteArray(padding - (msg.length() % padding), ' ');
+}
 
-    int encryptedHexSize = (msgSize + crypto_secretbox_MACBYTES) * 2 + 1;
-    char * encryptedHex = new char[encryptedHexSize];     
-    sodium_memzero(encryptedHex, encryptedHexSize);
-    sodium_bin2hex(encryptedHex, encryptedHexSize, encrpyted, msgSize + crypto_secretbox_MACBYTES);
+// Encrypt an outgoing message with the session's secret key, as hex in a JSON text message
+QString AppDataServer::encryptOutgoing(AppSession* s, const QByteArray& msg, int padding) {
+    auto sealed = s->seal(padOutgoing(msg, padding));
 
     auto json =  QJsonDocument(QJsonObject{
-            {"nonce", QString(newLocalNonce)},
-            {"payload", QString(encryptedHex)},
-            {"to", getWormholeCode(getSecretHex())}
+            {"nonce", QString::fromLatin1(sealed.left(crypto_secretbox_NONCEBYTES).toHex())},
+            {"payload", QString::fromLatin1(sealed.mid(crypto_secretbox_NONCEBYTES).toHex())},
+            {"to", s->getWormholeCode()}
         });
-    delete[] noncebin;
-    delete[] newLocalNonce;
-    delete[] secret;
-    delete[] encrpyted;
-    delete[] encryptedHex;
 
     return json.toJson();
 }
 
-/**
-  Attempt to decrypt a message. If the decryption fails, it returns the string "error", the decrypted message otherwise. 
-  It will use the given secret to attempt decryption. In addition, it will enforce that the nonce is greater than the last seen nonce, 
-  unless the skipNonceCheck = true, which is used when attempting decrytption with a temp secret key.
-*/
-QString AppDataServer::decryptMessage(QJsonDocument msg, QString secretHex, QString lastRemoteNonceHex) {
-    qDebug() << "Decrypting message";
-    // Decrypt and then process
-    QString noncehex = msg.object().value("nonce").toString();
-    QString encryptedhex = msg.object().value("payload").toString();
-
-    // Enforce limits on the size of the message
-    int MAX_LENGTH = 2*50*1024; // 50kb
-    if (noncehex.length() > ((int)crypto_secretbox_NONCEBYTES * 2) || encryptedhex.length() > MAX_LENGTH) {
-        qDebug() << "Encrypted hex size of " << encryptedhex.length() << " bytes is too large!";
-        return "error";
-    }
-
-    // Check to make sure that the nonce is greater than the last known remote nonce
-    unsigned char* lastRemoteBin = new unsigned char[crypto_secretbox_NONCEBYTES];
-    sodium_hex2bin(lastRemoteBin, crypto_secretbox_NONCEBYTES, lastRemoteNonceHex.toStdString().c_str(), lastRemoteNonceHex.length(),
-        NULL, NULL, NULL);
-
-    unsigned char* noncebin = new unsigned char[crypto_secretbox_NONCEBYTES];
-    sodium_hex2bin(noncebin, crypto_secretbox_NONCEBYTES, noncehex.toStdString().c_str(), noncehex.length(),
-        NULL, NULL, NULL);
-
-    assert(crypto_secretbox_KEYBYTES == crypto_hash_sha256_BYTES);
-    if (sodium_compare(lastRemoteBin, noncebin, crypto_secretbox_NONCEBYTES) != -1) {
-        // Refuse to accept a lower nonce, return an error
-        delete[] lastRemoteBin;
-        delete[] noncebin;
-        qDebug() << "Repeated nonce detected, potential attack or misconfiguration! Bailing out.";
-        return "error";
-    }
-    
-    unsigned char* secret = new unsigned char[crypto_secretbox_KEYBYTES];
-    sodium_hex2bin(secret, crypto_secretbox_KEYBYTES, secretHex.toStdString().c_str(), crypto_secretbox_KEYBYTES*2, 
-        NULL, NULL, NULL);
-
-    unsigned char* encrypted = new unsigned char[encryptedhex.length() / 2];
-    sodium_hex2bin(encrypted, encryptedhex.length() / 2, encryptedhex.toStdString().c_str(), encryptedhex.length(),
-                    NULL, NULL, NULL);
+// Encrypt an outgoing message with the session's secret key, as a [version|nonce|ciphertext] frame
+QByteArray AppDataServer::encryptOutgoingBinary(AppSession* s, const QByteArray& msg, int padding) {
+    auto frame = s->seal(padOutgoing(msg, padding), 1);
+    frame[0] = binaryFrameVersion;
+    return frame;
+}
 
-    int decryptedLen = encryptedhex.length() / 2 - crypto_secretbox_MACBYTES;
-    unsigned char* decrypted = new unsigned char[decryptedLen];
-    int result = crypto_secretbox_open_easy(decrypted, encrypted, encryptedhex.length() / 2, noncebin, secret);
+// Replies are encrypted for the app that the client's message came from. Clients that talk to us in
+// binary frames get binary frames back. The wormhole only relays text.
+void AppDataServer::sendEncrypted(std::shared_ptr<ClientWebSocket> pClient, const QByteArray& msg, int padding) {
+    auto s = pClient->getSession();
+    if (s == nullptr)
+        return;
 
-    QString payload;
-    if (result == -1) {
-        payload = "error";        
+    if (pClient->isBinary()) {
+        pClient->sendBinaryMessage(encryptOutgoingBinary(s.get(), msg, padding));
     } else {
-        // Update the last seen remote hex
-        saveNonceHex(NonceType::REMOTE, noncehex);
-        saveLastSeenTime();
-
-        char* decryptedStr = new char[decryptedLen + 1];
-        sodium_memzero(decryptedStr, decryptedLen + 1);
-        memcpy(decryptedStr, decrypted, decryptedLen);
-
-        payload = QString(decryptedStr);
-
-        delete[] decryptedStr;
+        pClient->sendTextMessage(encryptOutgoing(s.get(), msg, padding));
     }
+}
 
-    delete[] secret;
-    delete[] lastRemoteBin;
-    delete[] noncebin;
-    delete[] encrypted;
-    delete[] decrypted;
+void AppDataServer::replyWithError(std::shared_ptr<ClientWebSocket> pClient) {
+    const auto& all = getSessions();
+    auto r = QJsonDocument(QJsonObject{
+                {"error", "Encryption error"},
+                {"to", !all.isEmpty() ? all.first()->getWormholeCode() : getWormholeCode(getSecretHex())}
+        }).toJson();
+    pClient->sendTextMessage(r);
+}
 
-    qDebug() << "Returning decrypted payload="<<payload;
-    return payload;
+// Strict hex decoding: fails on odd lengths and on anything that isn't a hex digit
+static bool decodeHex(const QString& hex, QByteArray* out) {
+    auto latin1 = hex.toLatin1();
+    QByteArray bin(latin1.size() / 2, '\0');
+    size_t len = 0;
+    if (latin1.size() % 2 != 0 ||
+            sodium_hex2bin(reinterpret_cast<uchar*>(bin.data()), bin.size(), latin1.constData(), latin1.size(),
+                           NULL, &len, NULL) != 0 ||
+            len != (size_t)bin.size())
+        return false;
+
+    *out = bin;
+    return true;
 }
 
 // Process an incoming text message. The message has to be encrypted with the secret key (or the temporary secret key)
 void AppDataServer::processMessage(QString message, MainWindow* mainWindow, std::shared_ptr<ClientWebSocket> pClient, AppConnectionType connType) {
     qDebug() << "processMessage message";
     //qDebug() << "processMessage message=" << message; // this can log sensitive info
-    auto replyWithError = [=]() {
-        auto r = QJsonDocument(QJsonObject{
-                    {"error", "Encryption error"},
-                    {"to", getWormholeCode(getSecretHex())}
-            }).toJson();
-            pClient->sendTextMessage(r);
-            return;
-    };
     
     // First, extract the command from the message
     auto msg = QJsonDocument::fromJson(message.toUtf8());
@@ -639,60 +868,121 @@ void AppDataServer::processMessage(QString message, MainWindow* mainWindow, std:
 
     // Then, check if the message is encrpted
     if (!msg.object().contains("nonce")) {
-        replyWithError();
+        replyWithError(pClient);
         return;
     }
 
-    auto decrypted = decryptMessage(msg, getSecretHex(), getNonceHex(NonceType::REMOTE));
+    QString noncehex = msg.object().value("nonce").toString();
+    QString encryptedhex = msg.object().value("payload").toString();
 
-    // If the decryption failed, maybe this is a new connection, so see if the dialog is open and a 
-    // temp secret is in place
-    if (decrypted == "error") {
-        // If the dialog is open, then there might be a temporary, new secret key. Attempt to decrypt
-        // with that.
-        if (!tempSecret.isEmpty()) {
-            // Since this is a temp secret, the last seen nonce will be "0", so basically we'll accept any nonce
-            QString zeroNonce = QString("00").repeated(crypto_secretbox_NONCEBYTES);
-            decrypted = decryptMessage(msg, tempSecret, zeroNonce);
-            if (decrypted == "error") {
-                // Oh, well. Just return an error
-                replyWithError();
-                return;
-            }
-            else {
-                // This is a new connection. So, update the the secret. Note the last seen remote nonce has already been updated by
-                // decryptMessage()
-                saveNewSecret(tempSecret);
-                setAllowInternetConnection(tempWormholeClient != nullptr);
-
-                // Swap out the wormhole connection
-                mainWindow->replaceWormholeClient(tempWormholeClient);
-                tempWormholeClient = nullptr;
-
-                saveLastConnectedOver(connType);
-                processDecryptedMessage(decrypted, mainWindow, pClient);
-
-                // If the Connection UI is showing, we have to update the UI as well
-                if (ui != nullptr) {
-                    // Update the connected phone information
-                    updateConnectedUI();
-
-                    // Update with a new QR Code for safety, so this secret isn't used by anyone else
-                    updateUIWithNewQRCode(mainWindow);
-                }
+    if (noncehex.length() != ((int)crypto_secretbox_NONCEBYTES * 2) || encryptedhex.length() > 2 * maxEncryptedSize) {
+        qDebug() << "Encrypted hex size of " << encryptedhex.length() << " bytes is too large!";
+        replyWithError(pClient);
+        return;
+    }
 
-                return;
-            }
-        }
-        else {
-            replyWithError();
+    // QByteArray::fromHex skips anything that isn't hex, which would leave the nonce short
+    QByteArray nonce, encrypted;
+    if (!decodeHex(noncehex, &nonce) || !decodeHex(encryptedhex, &encrypted) ||
+            nonce.size() != (int)crypto_secretbox_NONCEBYTES) {
+        qDebug() << "Invalid hex in the nonce or payload";
+        replyWithError(pClient);
+        return;
+    }
+
+    processEncrypted(nonce, encrypted, mainWindow, pClient, connType);
+}
+
+// Process an incoming binary frame: [version|nonce|ciphertext]
+void AppDataServer::processBinaryMessage(const QByteArray& frame, MainWindow* mainWindow, std::shared_ptr<ClientWebSocket> pClient, AppConnectionType connType) {
+    qDebug() << "processBinaryMessage";
+
+    const int headerSize = 1 + crypto_secretbox_NONCEBYTES;
+    if (frame.size() < headerSize || frame.size() > headerSize + maxEncryptedSize || frame[0] != binaryFrameVersion) {
+        qDebug() << "Invalid binary frame of" << frame.size() << "bytes";
+        replyWithError(pClient);
+        return;
+    }
+
+    // The nonce and ciphertext are only views into the frame
+    processEncrypted(QByteArray::fromRawData(frame.constData() + 1, crypto_secretbox_NONCEBYTES),
+                     QByteArray::fromRawData(frame.constData() + headerSize, frame.size() - headerSize),
+                     mainWindow, pClient, connType);
+}
+
+void AppDataServer::processEncrypted(const QByteArray& nonce, const QByteArray& ciphertext, MainWindow* mainWindow,
+                                     std::shared_ptr<ClientWebSocket> pClient, AppConnectionType connType) {
+    // Everything below reads a whole nonce
+    if (nonce.size() != (int)crypto_secretbox_NONCEBYTES) {
+        replyWithError(pClient);
+        return;
+    }
+
+    auto nonceBin = reinterpret_cast<const uchar*>(nonce.constData());
+    auto cipherBin = reinterpret_cast<const uchar*>(ciphertext.constData());
+
+    QByteArray decrypted;
+
+    // Try the session this client used last first, and then the other paired apps. A session
+    // the client still holds is only used if its app is still paired.
+    const auto& all = getSessions();
+    auto last = pClient->getSession();
+    QList<std::shared_ptr<AppSession>> candidates;
+    if (last != nullptr && all.contains(last))
+        candidates.push_back(last);
+    for (const auto& s : all) {
+        if (s != last)
+            candidates.push_back(s);
+    }
+
+    for (const auto& s : candidates) {
+        if (s->open(nonceBin, cipherBin, ciphertext.size(), &decrypted)) {
+            pClient->setSession(s);
+            markSeen(connType);
+            processDecryptedMessage(QString::fromUtf8(decrypted.constData()), mainWindow, pClient);
             return;
         }
-    } else {
-        saveLastConnectedOver(connType);
-        processDecryptedMessage(decrypted, mainWindow, pClient);
+    }
+
+    // If the decryption failed, maybe this is a new connection, so see if the dialog is open and a 
+    // temp secret is in place
+    if (tempSecret.isEmpty()) {
+        replyWithError(pClient);
+        return;
+    }
+
+    // Since this is a temp secret, the last seen nonce will be "0", so basically we'll accept any nonce
+    auto tempSession = std::make_shared<AppSession>(tempSecret);
+    if (!tempSession->open(nonceBin, cipherBin, ciphertext.size(), &decrypted)) {
+        // Oh, well. Just return an error
+        replyWithError(pClient);
         return;
     }
+
+    // This is a new connection. So, pair the secret, and keep the session, which already has
+    // the remote nonce of this message.
+    saveNewSecret(tempSecret);
+    tempSession->restoreLocalNonce();
+    getSessions();
+    sessions[0] = tempSession;
+    pClient->setSession(tempSession);
+    setAllowInternetConnection(tempWormholeClient != nullptr);
+
+    // Swap out the wormhole connection
+    mainWindow->replaceWormholeClient(tempWormholeClient);
+    tempWormholeClient = nullptr;
+
+    markSeen(connType);
+    processDecryptedMessage(QString::fromUtf8(decrypted.constData()), mainWindow, pClient);
+
+    // If the Connection UI is showing, we have to update the UI as well
+    if (ui != nullptr) {
+        // Update the connected phone information
+        updateConnectedUI();
+
+        // Update with a new QR Code for safety, so this secret isn't used by anyone else
+        updateUIWithNewQRCode(mainWindow);
+    }
 }
 
 // Decrypted method will be executed here. 
@@ -706,7 +996,7 @@ void AppDataServer::processDecryptedMessage(QString message, MainWindow* mainWin
             {"errorCode", -1},
             {"errorMessage", "Unknown JSON format"}
         }).toJson();
-        pClient->sendTextMessage(encryptOutgoing(r));
+        sendEncrypted(pClient, r);
         return;
     }
     
@@ -714,29 +1004,38 @@ void AppDataServer::processDecryptedMessage(QString message, MainWindow* mainWin
         processGetInfo(msg.object(), mainWindow, pClient);
     }
     else if (msg.object()["command"] == "getTransactions") {
-        processGetTransactions(mainWindow, pClient);
+        processGetTransactions(msg.object(), mainWindow, pClient);
     }
     else if (msg.object()["command"] == "sendTx") {
         processSendTx(msg.object()["tx"].toObject(), mainWindow, pClient);
     }
+    else if (msg.object()["command"] == "subscribe") {
+        processSubscribe(msg.object(), pClient);
+    }
     else {
         auto r = QJsonDocument(QJsonObject{
             {"errorCode", -1},
             {"errorMessage", "Command not found:" + msg.object()["command"].toString()}
         }).toJson();
-        pClient->sendTextMessage(encryptOutgoing(r));
+        sendEncrypted(pClient, r);
     }
 }
 
 // "sendTx" command. This method will actually send money, so be careful with everything
 void AppDataServer::processSendTx(QJsonObject sendTx, MainWindow* mainwindow, std::shared_ptr<ClientWebSocket> pClient) {
     qDebug() << "processSendTx with to=" << sendTx["to"].toString();
+
+    // If we crash after this, a replay of the same message must still be refused, so its nonce
+    // is on disk before anything is sent
+    if (pClient->getSession() != nullptr)
+        pClient->getSession()->checkpointNonces(true);
+
     auto error = [=](QString reason) {
         auto r = QJsonDocument(QJsonObject{
            {"errorCode", -1},
            {"errorMessage", "Couldn't send Tx:" + reason}
         }).toJson();
-        pClient->sendTextMessage(encryptOutgoing(r));
+        sendEncrypted(pClient, r);
         return;
     };
 
@@ -752,15 +1051,15 @@ void AppDataServer::processSendTx(QJsonObject sendTx, MainWindow* mainwindow, st
 
     // Find a from address that has at least the sending amout
     double amt = sendTx["amount"].toString().toDouble();
-    auto allBalances = mainwindow->getRPC()->getAllBalances();
+    auto state = mainwindow->getRPC()->getWalletState();
     QList<QPair<QString, double>> bals;
-    for (auto i : allBalances->keys()) {
+    for (const auto& i : state ? state->getAddresses() : QVector<QString>()) {
         // Filter out balances that don't have the requisite amount
         // TODO: should this be amt+tx.fee?
-        if (allBalances->value(i) < amt)
+        if (state->getBalanceZats(i) < WalletState::toZats(amt))
             continue;
 
-        bals.append(QPair<QString, double>(i, allBalances->value(i)));
+        bals.append(QPair<QString, double>(i, state->getBalance(i)));
     }
 
     if (bals.isEmpty()) {
@@ -798,7 +1097,7 @@ void AppDataServer::processSendTx(QJsonObject sendTx, MainWindow* mainwindow, st
                {"command", "sendTxSubmitted"},
                {"txid",  txid}
             }).toJson();
-            pClient->sendTextMessage(encryptOutgoing(r));
+            sendEncrypted(pClient, r);
         },
         // Errored while submitting Tx
         [=] (QString, QString errStr) {
@@ -807,7 +1106,7 @@ void AppDataServer::processSendTx(QJsonObject sendTx, MainWindow* mainwindow, st
                {"command", "sendTxFailed"},
                {"err",  errStr}
             }).toJson();
-            pClient->sendTextMessage(encryptOutgoing(r));
+            sendEncrypted(pClient, r);
         }   
     );
 
@@ -816,7 +1115,7 @@ void AppDataServer::processSendTx(QJsonObject sendTx, MainWindow* mainwindow, st
             {"command", "sendTx"},
             {"result",  "success"}
         }).toJson();
-    pClient->sendTextMessage(encryptOutgoing(r));
+    sendEncrypted(pClient, r);
 }
 
 // "getInfo" command
@@ -824,25 +1123,25 @@ void AppDataServer::processGetInfo(QJsonObject jobj, MainWindow* mainWindow, std
     auto connectedName = jobj["name"].toString();
     
     if (mainWindow == nullptr || mainWindow->getRPC() == nullptr ||
-            mainWindow->getRPC()->getAllBalances() == nullptr) {
+            mainWindow->getRPC()->getWalletState() == nullptr) {
         pClient->close(QWebSocketProtocol::CloseCodeNormal, "Not yet ready");
         return;
     }
 
 
     // Max spendable safely from a z address and from any address
-    double maxZSpendable = 0;
-    double maxSpendable = 0;
-    for (auto a : mainWindow->getRPC()->getAllBalances()->keys()) {
+    auto state = mainWindow->getRPC()->getWalletState();
+    qint64 maxZSpendableZats = 0;
+    qint64 maxSpendableZats = 0;
+    for (const auto& a : state->getAddresses()) {
+        auto bal = state->getBalanceZats(a);
         if (Settings::getInstance()->isSaplingAddress(a)) {
-            if (mainWindow->getRPC()->getAllBalances()->value(a) > maxZSpendable) {
-                maxZSpendable = mainWindow->getRPC()->getAllBalances()->value(a);
-            }
-        }
-        if (mainWindow->getRPC()->getAllBalances()->value(a) > maxSpendable) {
-            maxSpendable = mainWindow->getRPC()->getAllBalances()->value(a);
+            maxZSpendableZats = std::max(maxZSpendableZats, bal);
         }
+        maxSpendableZats = std::max(maxSpendableZats, bal);
     }
+    double maxZSpendable = WalletState::fromZats(maxZSpendableZats);
+    double maxSpendable  = WalletState::fromZats(maxSpendableZats);
 
     setConnectedName(connectedName);
 
@@ -858,16 +1157,55 @@ void AppDataServer::processGetInfo(QJsonObject jobj, MainWindow* mainWindow, std
         {"zecprice", Settings::getInstance()->getZECPrice()},
         {"serverversion", QString(APP_VERSION)}
     }).toJson();
-    pClient->sendTextMessage(encryptOutgoing(r));
+    sendEncrypted(pClient, r);
 }
 
-void AppDataServer::processGetTransactions(MainWindow* mainWindow, std::shared_ptr<ClientWebSocket> pClient) {
+/**
+ * "getTransactions" command. Without a cursor, it returns the newest txs. A cursor is the
+ * "datetime" and "txid" of a tx the app already has: with "since" it returns only the txs newer
+ * than that one, and with "before" the page of txs older than it. At most "limit" rows are
+ * returned, plus the rest of the last tx's rows, and "more" says if any were left out. The
+ * rows have no block height, so the cursor is the same datetime/txid order the model is in.
+ */
+void AppDataServer::processGetTransactions(QJsonObject jobj, MainWindow* mainWindow, std::shared_ptr<ClientWebSocket> pClient) {
     QJsonArray txns;
     auto model = mainWindow->getRPC()->getTransactionsModel();
     qDebug() << "processGetTransactions";
 
-    // Manually add pending ops, so that computing transactions will also show up
-    auto wtxns = mainWindow->getRPC()->getWatchingTxns();
+    int count = model->rowCount(QModelIndex());
+    int limit = Settings::getMaxMobileAppTxns();
+    if (jobj.contains("limit"))
+        limit = qBound(1, jobj["limit"].toInt(), Settings::getMaxMobileAppPage());
+
+    auto since  = jobj["since"].toObject();
+    auto before = jobj["before"].toObject();
+
+    int start = 0;
+    int end   = 0;
+    bool more = false;
+    if (!before.isEmpty()) {
+        start = model->cursorEnd(before["datetime"].toVariant().toLongLong(), before["txid"].toString());
+        end   = std::min(count, start + limit);
+        if (end > start)
+            end = model->txEnd(end - 1);
+        more  = end < count;
+    } else if (!since.isEmpty()) {
+        // The rows just above the cursor, so that paging with "since" again leaves no gaps
+        end   = model->cursorStart(since["datetime"].toVariant().toLongLong(), since["txid"].toString());
+        start = std::max(0, end - limit);
+        if (start < end)
+            start = model->txStart(start);
+        more  = start > 0;
+    } else {
+        end   = std::min(count, limit);
+        if (end > 0)
+            end = model->txEnd(end - 1);
+        more  = end < count;
+    }
+
+    // Manually add pending ops, so that computing transactions will also show up. They're always
+    // newer than anything in the model, so they're left out of older pages.
+    auto wtxns = before.isEmpty() ? mainWindow->getRPC()->getWatchingTxns() : QMap<QString, WatchedTx>();
     for (auto opid : wtxns.keys()) {
         txns.append(QJsonObject{
             {"type", "send"},
@@ -881,7 +1219,7 @@ void AppDataServer::processGetTransactions(MainWindow* mainWindow, std::shared_p
     }
     
     // Add transactions
-    for (int i = 0; i < model->rowCount(QModelIndex()) && i < Settings::getMaxMobileAppTxns(); i++) {
+    for (int i = start; i < end; i++) {
         txns.append(QJsonObject{
             {"type", model->getType(i)},
             {"datetime", model->getDate(i)},
@@ -896,9 +1234,78 @@ void AppDataServer::processGetTransactions(MainWindow* mainWindow, std::shared_p
     auto r = QJsonDocument(QJsonObject{
             {"version", 1.0},
             {"command", "getTransactions"},
-            {"transactions", txns}
+            {"transactions", txns},
+            {"more", more}
+        }).toJson();
+    sendEncrypted(pClient, r);
+}
+
+// "subscribe" command. The app lists the "events" it wants pushed to it, all of them if it doesn't
+// list any, and an empty list unsubscribes it. It lasts as long as the connection does.
+void AppDataServer::processSubscribe(QJsonObject jobj, std::shared_ptr<ClientWebSocket> pClient) {
+    static const QSet<QString> knownEvents = { "newBlock", "balanceChanged", "txConfirmed", "opCompleted" };
+
+    QSet<QString> events;
+    if (!jobj.contains("events")) {
+        events = knownEvents;
+    } else {
+        for (const auto& e : jobj["events"].toArray()) {
+            if (knownEvents.contains(e.toString()))
+                events.insert(e.toString());
+        }
+    }
+
+    // Wormhole messages each come with a new ClientWebSocket, so look for an older one by its socket
+    auto socket = pClient->getSocket();
+    for (auto it = subscribers.begin(); it != subscribers.end(); ) {
+        if ((*it)->getSocket() == socket)
+            it = subscribers.erase(it);
+        else
+            it++;
+    }
+
+    pClient->setSubscriptions(events);
+    if (!events.isEmpty())
+        subscribers.push_back(pClient);
+
+    QJsonArray subscribed;
+    for (const auto& e : events)
+        subscribed.append(e);
+
+    auto r = QJsonDocument(QJsonObject{
+            {"version", 1.0},
+            {"command", "subscribe"},
+            {"events", subscribed}
         }).toJson();
-    pClient->sendTextMessage(encryptOutgoing(r));
+    sendEncrypted(pClient, r);
+}
+
+/**
+ * Push an event to the apps that subscribed to it, encrypted like any other reply, but padded to
+ * the much smaller eventPadding. Apps that have
+ * gone away or were unpaired since are dropped here.
+ */
+void AppDataServer::pushEvent(const QString& event, QJsonObject fields) {
+    if (subscribers.isEmpty())
+        return;
+
+    fields["version"] = 1.0;
+    fields["command"] = "event";
+    fields["event"]   = event;
+    auto msg = QJsonDocument(fields).toJson(QJsonDocument::Compact);
+
+    const auto& paired = getSessions();
+    for (auto it = subscribers.begin(); it != subscribers.end(); ) {
+        auto client = *it;
+        if (!client->isConnected() || !paired.contains(client->getSession())) {
+            it = subscribers.erase(it);
+            continue;
+        }
+
+        if (client->isSubscribed(event))
+            sendEncrypted(client, msg, eventPadding);
+        it++;
+    }
 }
 
 // ==============================
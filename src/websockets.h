@@ -11,21 +11,47 @@ QT_FORWARD_DECLARE_CLASS(QWebSocketServer)
 QT_FORWARD_DECLARE_CLASS(QWebSocket)
 
 class WSServer;
+class AppSession;
 
 // We're going to wrap the websocket in this class, because the underlying QWebSocket might get closed
 // or deleted while a callback is waiting to get the data back. Therefore, we write a custom "sendTextMessage"
 // class that checks all this before sending.
+// A client that sent a binary frame gets its replies as binary frames too, see AppDataServer::sendEncrypted
+// The session is the one the client's last message was decrypted with, and its replies are encrypted with.
+// The socket and server are only weakly held, since subscribed clients outlive the message they came with.
 class ClientWebSocket {
 public:
-    ClientWebSocket(QWebSocket* c, WSServer* s = nullptr) { client = c; server = s; }
+    ClientWebSocket(QWebSocket* c, WSServer* s = nullptr, bool b = false);
 
     void sendTextMessage(QString m);
-    void close(QWebSocketProtocol::CloseCode code, const QString& msg) { client->close(code, msg); }
+    void sendBinaryMessage(const QByteArray& m);
+    bool isConnected();
+    bool isBinary() const { return binary; }
+    void setBinary(bool b) { binary = b; }
+    void close(QWebSocketProtocol::CloseCode code, const QString& msg) { if (client) client->close(code, msg); }
+
+    QWebSocket*                 getSocket() const                     { return client; }
+
+    std::shared_ptr<AppSession> getSession() const                   { return session; }
+    void                        setSession(std::shared_ptr<AppSession> s) { session = s; }
+
+    // The events pushed to this client, see AppDataServer::pushEvent
+    bool                        isSubscribed(const QString& event) const  { return subscriptions.contains(event); }
+    void                        setSubscriptions(const QSet<QString>& events) { subscriptions = events; }
 private:
-    QWebSocket* client;
-    WSServer*   server;
+    QPointer<QWebSocket>    client;
+    QPointer<WSServer>      server;
+    bool                    binary;
+
+    std::shared_ptr<AppSession> session;
+    QSet<QString>               subscriptions;
 };
 
+/**
+ * Listens for direct connections from the mobile apps. Each connection gets its own queue of
+ * received messages, and the queues are served round robin, one message at a time, so a busy
+ * client can't hold up the others.
+ */
 class WSServer : public QObject
 {
     Q_OBJECT
@@ -34,6 +60,8 @@ public:
     bool isValidConnection(QWebSocket* c) { return m_clients.contains(c); }
     ~WSServer();
 
+    static const int maxPendingPerClient = 16;
+
 Q_SIGNALS:
     void closed();
 
@@ -42,11 +70,26 @@ private Q_SLOTS:
     void processTextMessage(QString message);
     void processBinaryMessage(QByteArray message);
     void socketDisconnected();
+    void processNext();
 
 private:
+    struct PendingMessage {
+        bool        binary;
+        QByteArray  data;
+    };
+
+    struct ClientState {
+        std::shared_ptr<ClientWebSocket>  client;
+        QQueue<PendingMessage>            pending;
+    };
+
+    void enqueue(QWebSocket* pClient, bool binary, const QByteArray& data);
+
     QWebSocketServer *m_pWebSocketServer;
     MainWindow *m_mainWindow;
-    QList<QWebSocket *> m_clients;
+    QHash<QWebSocket *, ClientState> m_clients;
+    QQueue<QWebSocket *> m_ready;       // Clients with pending messages, in the order they'll be served
+    bool m_scheduled = false;
     bool m_debug;
 };
 
@@ -75,9 +118,55 @@ private:
     bool shuttingDown        = false;
 };
 
-enum NonceType {
-    LOCAL = 1,
-    REMOTE
+/**
+ * The secret key and nonces of a connection to the mobile app. They're decoded once, and kept in
+ * locked memory (sodium_malloc), instead of being converted from hex and read from QSettings for
+ * every message.
+ *
+ * Our own (local) nonces are reserved in QSettings a block at a time, so a crash can never make us
+ * reuse one. The last remote nonce is only checkpointed, by checkpointNonces(), except before a
+ * sendTx runs, when it is synced to disk so the same message can't send money twice.
+ */
+class AppSession {
+public:
+    explicit AppSession(const QString& secretHex);
+    ~AppSession();
+
+    QString     getWormholeCode() const { return wormholeCode; }
+
+    // Where the nonces of the app with this wormhole code are kept in QSettings
+    static QString settingsGroupOf(const QString& wormholeCode);
+
+    // Continue from the nonces saved in QSettings
+    void        restoreNonces();
+    void        restoreLocalNonce();
+    // Synced writes are only for messages that mustn't be replayed after a crash
+    void        checkpointNonces(bool sync = false);
+
+    // Encrypt msg with the next local nonce. Returns [reserved bytes|nonce|ciphertext], the
+    // reserved bytes at the front are left for the caller's header.
+    QByteArray  seal(const QByteArray& msg, int reserved = 0);
+
+    // Decrypt a message, but only if its nonce is newer than the last one we accepted
+    bool        open(const uchar* nonce, const uchar* ciphertext, int len, QByteArray* msg);
+
+    static const int    localNonceBlock = 256;      // Messages per local nonce reservation
+
+private:
+    struct Keys {
+        uchar   secret[crypto_secretbox_KEYBYTES];
+        uchar   localNonce[crypto_secretbox_NONCEBYTES];
+        uchar   remoteNonce[crypto_secretbox_NONCEBYTES];
+    };
+
+    void        reserveLocalNonces();
+    QByteArray  savedNonce(const char* key, const QString& defaultHex);
+
+    Keys*       keys;
+    QString     wormholeCode;
+    QString     settingsGroup;      // Each paired app has its own nonces in QSettings
+    int         localNoncesLeft = 0;
+    bool        remoteDirty     = false;
 };
 
 enum AppConnectionType {
@@ -100,21 +189,33 @@ public:
 
     void          processSendTx(QJsonObject sendTx, MainWindow* mainwindow, std::shared_ptr<ClientWebSocket> pClient);
     void          processMessage(QString message, MainWindow* mainWindow, std::shared_ptr<ClientWebSocket> pClient, AppConnectionType connType);
+    void          processBinaryMessage(const QByteArray& frame, MainWindow* mainWindow, std::shared_ptr<ClientWebSocket> pClient, AppConnectionType connType);
     void          processGetInfo(QJsonObject jobj, MainWindow* mainWindow, std::shared_ptr<ClientWebSocket> pClient);
     void          processDecryptedMessage(QString message, MainWindow* mainWindow, std::shared_ptr<ClientWebSocket> pClient);
-    void          processGetTransactions(MainWindow* mainWindow, std::shared_ptr<ClientWebSocket> pClient);
+    void          processGetTransactions(QJsonObject jobj, MainWindow* mainWindow, std::shared_ptr<ClientWebSocket> pClient);
+    void          processSubscribe(QJsonObject jobj, std::shared_ptr<ClientWebSocket> pClient);
+
+    // Events that apps can subscribe to: newBlock, balanceChanged, txConfirmed and opCompleted
+    void          pushEvent(const QString& event, QJsonObject fields);
 
-    QString       decryptMessage(QJsonDocument msg, QString secretHex, QString lastRemoteNonceHex);
-    QString       encryptOutgoing(QString msg);
+    // Messages are padded to a multiple of padding, so that their length says little about them
+    static const int replyPadding = 16*1024;
+    static const int eventPadding = 512;
+
+    void          sendEncrypted(std::shared_ptr<ClientWebSocket> pClient, const QByteArray& msg, int padding = replyPadding);
+    QString       encryptOutgoing(AppSession* s, const QByteArray& msg, int padding = replyPadding);
+    QByteArray    encryptOutgoingBinary(AppSession* s, const QByteArray& msg, int padding = replyPadding);
 
     QString       getWormholeCode(QString secretHex);
     QString       getSecretHex();
     void          saveNewSecret(QString secretHex);
 
+    static const int maxPairedApps = 8;
+
     void          registerNewTempSecret(QString tmpSecretHex, bool allowInternet, MainWindow* main);
 
-    QString       getNonceHex(NonceType nt);
-    void          saveNonceHex(NonceType nt, QString noncehex);
+    // Write the sessions' remote nonces and the last seen time to QSettings
+    void          checkpointNonces();
 
     bool          getAllowInternetConnection();
     void          setAllowInternetConnection(bool allow);
@@ -131,14 +232,33 @@ public:
     void               saveLastConnectedOver(AppConnectionType type);
     AppConnectionType  getLastConnectionType();
 
+    // Binary frames are [version|nonce|ciphertext]
+    static const char       binaryFrameVersion = 1;
+
 private:
     AppDataServer() = default;
 
+    const QList<std::shared_ptr<AppSession>>&  getSessions();
+    void          processEncrypted(const QByteArray& nonce, const QByteArray& ciphertext, MainWindow* mainWindow,
+                                   std::shared_ptr<ClientWebSocket> pClient, AppConnectionType connType);
+    void          migrateLegacyNonces();
+    void          scheduleCheckpoint();
+    void          markSeen(AppConnectionType connType);
+    void          replyWithError(std::shared_ptr<ClientWebSocket> pClient);
+
     static AppDataServer*   instance;
     Ui_MobileAppConnector*  ui;
 
     QString                 tempSecret;
     WormholeClient*         tempWormholeClient = nullptr;
+
+    // One for each paired app. The first one is for the primary secret, which the wormhole uses.
+    QList<std::shared_ptr<AppSession>>  sessions;
+    bool                    sessionsLoaded      = false;
+    QTimer*                 checkpointTimer     = nullptr;
+    qint64                  lastSeen            = 0;
+
+    QList<std::shared_ptr<ClientWebSocket>>  subscribers;
 };
 
 class AppDataModel {
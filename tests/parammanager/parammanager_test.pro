@@ -0,0 +1,31 @@
+#-------------------------------------------------
+#
+# ParamManager against a local HTTP server.
+#   qmake && make && ./parammanager_test
+#
+#-------------------------------------------------
+
+QT       += core gui network widgets websockets concurrent testlib
+
+CONFIG   += c++14 console testcase
+CONFIG   -= app_bundle
+
+TARGET    = parammanager_test
+TEMPLATE  = app
+
+ROOT = $$PWD/../..
+
+INCLUDEPATH  += $$ROOT/src/ $$ROOT/src/3rdparty/ $$ROOT/res
+
+SOURCES += \
+    tst_parammanager.cpp \
+    $$ROOT/src/parammanager.cpp \
+    $$ROOT/src/logger.cpp
+
+HEADERS += \
+    $$ROOT/src/parammanager.h \
+    $$ROOT/src/logger.h
+
+win32:CONFIG(release, debug|release): LIBS += -L$$ROOT/res/ -llibsodium
+else:win32:CONFIG(debug, debug|release): LIBS += -L$$ROOT/res/ -llibsodiumd
+else:unix: LIBS += -L$$ROOT/res/ -lsodium
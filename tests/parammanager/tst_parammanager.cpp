@@ -0,0 +1,245 @@
+#include <QtTest>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+
+#include "parammanager.h"
+#include "logger.h"
+
+/**
+ * Just enough of an HTTP/1.1 server to stand in for z.cash. It answers HEAD and GET for a single
+ * file, with or without Range support, and can cut off the first reply for a given range part
+ * way through. Every request it got is recorded as "HEAD", "GET" or "GET <first>-<last>".
+ */
+class ParamServer : public QObject {
+public:
+    QByteArray      body;
+    bool            advertiseRanges = true;     // Accept-Ranges: bytes in the HEAD reply
+    bool            honorRanges     = true;     // Otherwise a ranged GET gets the whole file, 200
+    qint64          dropAt          = -1;       // First byte of the range whose first reply is cut off
+    qint64          dropAfter       = 0;        // Bytes of it that are sent before that
+    QStringList     requests;
+
+    ParamServer() {
+        QObject::connect(&server, &QTcpServer::newConnection, [=] () {
+            while (server.hasPendingConnections()) {
+                auto socket = server.nextPendingConnection();
+                QObject::connect(socket, &QTcpSocket::readyRead,    [=] () { onRead(socket); });
+                QObject::connect(socket, &QTcpSocket::disconnected, [=] () {
+                    buffers.remove(socket);
+                    socket->deleteLater();
+                });
+            }
+        });
+        server.listen(QHostAddress::LocalHost);
+    }
+
+    QUrl url() const {
+        return QUrl("http://127.0.0.1:" + QString::number(server.serverPort()) + "/test.params");
+    }
+
+private:
+    void onRead(QTcpSocket* socket) {
+        auto& buf = buffers[socket];
+        buf.append(socket->readAll());
+        int end = buf.indexOf("\r\n\r\n");
+        if (end < 0)
+            return;
+
+        auto lines = buf.left(end).split('\n');
+        buf.clear();
+
+        auto method = lines.first().split(' ').first();
+        qint64 first = -1, last = -1;
+        for (const auto& line : lines) {
+            auto l = line.trimmed();
+            if (l.toLower().startsWith("range: bytes=")) {
+                auto range = l.mid(l.indexOf('=') + 1).split('-');
+                first = range.value(0).toLongLong();
+                last  = range.value(1).isEmpty() ? body.size() - 1 : range.value(1).toLongLong();
+            }
+        }
+
+        bool ranged = first >= 0 && method == "GET" && honorRanges;
+        requests.push_back(method + (first >= 0 && method == "GET" ? " " + QString::number(first) + "-" + QString::number(last) : QString()));
+
+        QByteArray content = ranged ? body.mid(first, last - first + 1) : body;
+        QByteArray head = ranged ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n";
+        head += "Content-Length: " + QByteArray::number(content.size()) + "\r\n";
+        if (advertiseRanges)
+            head += "Accept-Ranges: bytes\r\n";
+        if (ranged)
+            head += "Content-Range: bytes " + QByteArray::number(first) + "-" + QByteArray::number(last) +
+                    "/" + QByteArray::number(body.size()) + "\r\n";
+        head += "Connection: close\r\n\r\n";
+
+        socket->write(head);
+        if (method == "GET") {
+            if (ranged && first == dropAt) {
+                // Only once, so that the retry gets the rest
+                dropAt = -1;
+                content = content.left(dropAfter);
+            }
+            socket->write(content);
+        }
+        socket->disconnectFromHost();
+    }
+
+    QTcpServer                          server;
+    QHash<QTcpSocket*, QByteArray>      buffers;
+};
+
+class TestParamManager : public QObject {
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void init();
+    void cleanup();
+
+    void downloadsInChunks();
+    void resumesFromPartFile();
+    void startsOverIfResumedFileIsCorrupt();
+    void fallsBackWhenServerIgnoresRange();
+    void retriesFromWhereChunkStopped();
+
+private:
+    // Runs a download of the server's file into dir, and returns whether it succeeded
+    bool download();
+
+    QByteArray target() const   { return readFile(dir->filePath("test.params")); }
+    static QByteArray readFile(const QString& path);
+    QStringList ranges() const;
+
+    QTemporaryDir   settingsDir;
+    Logger*         logger = nullptr;
+    ParamServer*    server = nullptr;
+    QTemporaryDir*  dir    = nullptr;
+    ParamFile       param;
+};
+
+void TestParamManager::initTestCase() {
+    // The verified marks go to QSettings, so keep them away from the real ones
+    QCoreApplication::setOrganizationName("silentdragon-tests");
+    QSettings::setDefaultFormat(QSettings::IniFormat);
+    QSettings::setPath(QSettings::IniFormat, QSettings::UserScope, settingsDir.path());
+
+    logger = new Logger(this, settingsDir.filePath("parammanager_test.log"));
+}
+
+void TestParamManager::init() {
+    server = new ParamServer();
+    dir    = new QTemporaryDir();
+
+    // A bit over two chunks, and not a multiple of anything
+    server->body.reserve(9 * 1024 * 1024 + 123);
+    for (int i = 0; i < 9 * 1024 * 1024 + 123; i++)
+        server->body.append(char((i * 7 + i / 4096) & 0xff));
+
+    param = ParamFile{ "test.params", server->url(),
+                       QCryptographicHash::hash(server->body, QCryptographicHash::Sha256).toHex() };
+}
+
+void TestParamManager::cleanup() {
+    delete server;
+    delete dir;
+}
+
+bool TestParamManager::download() {
+    ParamManager params(logger, dir->path());
+
+    QEventLoop loop;
+    bool ok = false;
+    params.download({ param }, [] (const QString&, qint64, qint64, double, int) {},
+                    [&] (bool success, const QString&) {
+        ok = success;
+        loop.quit();
+    });
+
+    QTimer::singleShot(30000, &loop, &QEventLoop::quit);
+    loop.exec();
+    return ok;
+}
+
+QByteArray TestParamManager::readFile(const QString& path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    return file.readAll();
+}
+
+// The ranged GETs the server got, as "<first>-<last>". The chunks are fetched over several
+// connections at once, so the order they arrived in doesn't mean anything.
+QStringList TestParamManager::ranges() const {
+    QStringList ranged;
+    for (const auto& r : server->requests) {
+        if (r.startsWith("GET "))
+            ranged.push_back(r.mid(4));
+    }
+    ranged.sort();
+    return ranged;
+}
+
+void TestParamManager::downloadsInChunks() {
+    QVERIFY(download());
+    QCOMPARE(target(), server->body);
+    QVERIFY(!QFile::exists(dir->filePath("test.params.part")));
+
+    QCOMPARE(ranges(), QStringList({ "0-4194303", "4194304-8388607", "8388608-9437306" }));
+}
+
+void TestParamManager::resumesFromPartFile() {
+    const qint64 resumeAt = 5 * 1024 * 1024 + 7;
+    QFile part(dir->filePath("test.params.part"));
+    QVERIFY(part.open(QIODevice::WriteOnly));
+    part.write(server->body.left(resumeAt));
+    part.close();
+
+    QVERIFY(download());
+    QCOMPARE(target(), server->body);
+
+    // Nothing before the end of the .part file is fetched again
+    QVERIFY(ranges().contains(QString::number(resumeAt) + "-" + QString::number(resumeAt + 4 * 1024 * 1024 - 1)));
+    for (const auto& r : ranges())
+        QVERIFY(r.split('-').first().toLongLong() >= resumeAt);
+}
+
+void TestParamManager::startsOverIfResumedFileIsCorrupt() {
+    QFile part(dir->filePath("test.params.part"));
+    QVERIFY(part.open(QIODevice::WriteOnly));
+    part.write(QByteArray(1024 * 1024, 'x'));
+    part.close();
+
+    QVERIFY(download());
+    QCOMPARE(target(), server->body);
+
+    // The resumed download fails the hash check, and then the whole file is fetched
+    QVERIFY(ranges().contains("1048576-5242879"));
+    QVERIFY(ranges().contains("0-4194303"));
+}
+
+void TestParamManager::fallsBackWhenServerIgnoresRange() {
+    server->honorRanges = false;
+
+    QVERIFY(download());
+    QCOMPARE(target(), server->body);
+
+    // The first ranged GET got a 200, after which the file was fetched once, without a range
+    QCOMPARE(server->requests.count("GET"), 1);
+}
+
+void TestParamManager::retriesFromWhereChunkStopped() {
+    server->dropAt    = 4 * 1024 * 1024;
+    server->dropAfter = 1000;
+
+    QVERIFY(download());
+    QCOMPARE(target(), server->body);
+
+    // Only the missing part of the chunk is asked for again
+    QCOMPARE(ranges().count("4194304-8388607"), 1);
+    QCOMPARE(ranges().count("4195304-8388607"), 1);
+}
+
+QTEST_GUILESS_MAIN(TestParamManager)
+
+#include "tst_parammanager.moc"